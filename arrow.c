@@ -0,0 +1,457 @@
+/*
+** arrow.c
+**
+** Writes tables as Apache Arrow IPC streams: a schema message, then a
+** record batch message for each batch of rows, then an end-of-stream
+** marker. (See the Arrow columnar format specification.) Each value
+** of a row is set into its column's buffers, and when the batch is
+** full the buffers are written out as they are, as the body of a
+** record batch message.
+**
+** The metadata of each message is a FlatBuffers table, which is built
+** here by hand rather than with the FlatBuffers library.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "arrow.h"
+
+// Values from the Arrow Message.fbs and Schema.fbs definitions.
+#define METADATA_V5        4
+#define HEADER_SCHEMA      1
+#define HEADER_RECORDBATCH 3
+#define TYPE_INT           2
+#define TYPE_FLOATINGPOINT 3
+#define TYPE_UTF8          5
+#define TYPE_BOOL          6
+#define PRECISION_DOUBLE   2
+#define CONTINUATION       0xFFFFFFFFu
+
+#define FB_OFFSET (-1)
+
+/*
+** A FlatBuffer under construction. Unlike the FlatBuffers library,
+** which builds back to front, objects are written front to back: a
+** table is written with empty slots for its offsets to strings,
+** vectors and other tables, which are filled in as those objects
+** are written after it. Positions, rather than pointers, are kept,
+** since the buffer moves as it grows.
+*/
+
+typedef struct fbuf_t {
+  unsigned char *data;
+  size_t        length;
+  size_t        size;
+} fbuf;
+
+/*
+** A field of a table: a scalar of 1, 2, 4 or 8 bytes, or an offset
+** (FB_OFFSET), or absent (0). For offsets, fb_table sets slot to the
+** position of the offset in the table.
+*/
+
+typedef struct fbfield_t {
+  int                size;
+  unsigned long long value;
+  size_t             slot;
+} fbfield;
+
+/*
+** Forward declarations
+*/
+
+static size_t fb_zeros(fbuf* fb, size_t n);
+static size_t fb_align(fbuf* fb, size_t align);
+static void   fb_put(fbuf* fb, size_t pos, unsigned long long value, int size);
+static void   fb_point(fbuf* fb, size_t slot, size_t target);
+static size_t fb_table(fbuf* fb, fbfield* fields, int num_fields);
+static size_t fb_vector(fbuf* fb, size_t slot, int count, int element_size);
+static void   fb_string(fbuf* fb, size_t slot, const char* s);
+static void   write_bytes(arrow_writer* w, const void* bytes, size_t n);
+static int    write_message(arrow_writer* w, fbuf* fb);
+static int    write_schema(arrow_writer* w);
+static int    write_batch(arrow_writer* w);
+
+/*
+** Writer
+*/
+
+// Starts a stream on fp, with the given column names and types,
+// writing the schema. Rows are written in batches of batch_rows.
+arrow_writer* arrow_open(FILE* fp, int num_columns, char** names,
+                         arrow_type* types, int batch_rows) {
+  arrow_writer *w = calloc(1, sizeof(arrow_writer));
+  int          i;
+
+  w->fp = fp;
+  w->num_columns = num_columns;
+  w->columns = calloc(num_columns > 0 ? num_columns : 1, sizeof(arrow_column));
+  w->batch_rows = batch_rows;
+  for (i = 0; i < num_columns; i++) {
+    arrow_column *col = &w->columns[i];
+
+    col->name = strdup(names[i]);
+    col->type = types[i];
+    col->validity = calloc((batch_rows + 7) / 8, 1);
+    switch (col->type) {
+    case ARROW_INT64:
+    case ARROW_FLOAT64:
+      col->values = malloc((size_t) batch_rows * 8);
+      break;
+    case ARROW_BOOL:
+      col->values = calloc((batch_rows + 7) / 8, 1);
+      break;
+    case ARROW_UTF8:
+      col->offsets = calloc(batch_rows + 1, sizeof(int));
+      col->data_size = 65536;
+      col->data = malloc(col->data_size);
+      break;
+    }
+  }
+  write_schema(w);
+  return w;
+}
+
+// Sets the value of a column in the current row to NULL. The value
+// itself is left zero (or empty).
+void arrow_set_null(arrow_writer* w, int column) {
+  arrow_column *col = &w->columns[column];
+
+  col->null_count++;
+  switch (col->type) {
+  case ARROW_INT64:
+  case ARROW_FLOAT64:
+    memset(col->values + (size_t) w->rows * 8, 0, 8);
+    break;
+  case ARROW_UTF8:
+    col->offsets[w->rows+1] = col->offsets[w->rows];
+    break;
+  case ARROW_BOOL:
+    break;
+  }
+}
+
+void arrow_set_int64(arrow_writer* w, int column, long long value) {
+  arrow_column *col = &w->columns[column];
+
+  col->validity[w->rows >> 3] |= 1 << (w->rows & 7);
+  memcpy(col->values + (size_t) w->rows * 8, &value, 8);
+}
+
+void arrow_set_float64(arrow_writer* w, int column, double value) {
+  arrow_column *col = &w->columns[column];
+
+  col->validity[w->rows >> 3] |= 1 << (w->rows & 7);
+  memcpy(col->values + (size_t) w->rows * 8, &value, 8);
+}
+
+void arrow_set_utf8(arrow_writer* w, int column, const char* value, int length) {
+  arrow_column *col = &w->columns[column];
+  size_t       end = col->offsets[w->rows];
+
+  col->validity[w->rows >> 3] |= 1 << (w->rows & 7);
+  if (end + length > col->data_size) {
+    while (end + length > col->data_size)
+      col->data_size *= 2;
+    col->data = realloc(col->data, col->data_size);
+  }
+  memcpy(col->data + end, value, length);
+  col->offsets[w->rows+1] = end + length;
+}
+
+void arrow_set_bool(arrow_writer* w, int column, int value) {
+  arrow_column *col = &w->columns[column];
+
+  col->validity[w->rows >> 3] |= 1 << (w->rows & 7);
+  if (value)
+    col->values[w->rows >> 3] |= 1 << (w->rows & 7);
+}
+
+// Ends the current row, once all its values are set, writing out the
+// batch if it is full. Returns 0, or -1 if the batch can't be written.
+int arrow_end_row(arrow_writer* w) {
+  if (++w->rows < w->batch_rows)
+    return 0;
+  return write_batch(w);
+}
+
+// Writes out the last batch and the end-of-stream marker, and frees
+// the writer, setting *bytes (unless bytes is NULL) to the length of
+// the whole stream. Returns 0, or -1 if anything couldn't be written.
+int arrow_close(arrow_writer* w, long long* bytes) {
+  unsigned char eos[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0};
+  int           i, ok = 0;
+
+  if (w->rows > 0)
+    ok = write_batch(w);
+  write_bytes(w, eos, sizeof(eos));
+  if (fflush(w->fp) != 0 || ferror(w->fp))
+    ok = -1;
+  if (bytes != NULL)
+    *bytes = w->bytes;
+  for (i = 0; i < w->num_columns; i++) {
+    free(w->columns[i].name);
+    free(w->columns[i].validity);
+    free(w->columns[i].values);
+    free(w->columns[i].offsets);
+    free(w->columns[i].data);
+  }
+  free(w->columns);
+  free(w);
+  return ok;
+}
+
+/*
+** Messages
+*/
+
+// Writes the schema message: a field for each column, all nullable.
+static int write_schema(arrow_writer* w) {
+  static const union { int i; char c; } host = {1};
+  fbuf    fb = {NULL, 0, 0};
+  fbfield message[4] = {{2, METADATA_V5}, {1, HEADER_SCHEMA}, {FB_OFFSET}, {8, 0}};
+  fbfield schema[2] = {{2, host.c ? 0 : 1}, {FB_OFFSET}};
+  size_t  fields;
+  int     i, ok;
+
+  fb_zeros(&fb, 4);
+  fb_point(&fb, 0, fb_table(&fb, message, 4));
+  fb_point(&fb, message[2].slot, fb_table(&fb, schema, 2));
+  fields = fb_vector(&fb, schema[1].slot, w->num_columns, 4);
+  for (i = 0; i < w->num_columns; i++) {
+    // name, nullable, type_type, type, dictionary, children
+    fbfield field[6] = {{FB_OFFSET}, {1, 1}, {1, 0}, {FB_OFFSET}, {0}, {FB_OFFSET}};
+    fbfield type[2] = {{0}, {0}};
+    int     num_type_fields = 0;
+
+    switch (w->columns[i].type) {
+    case ARROW_INT64:
+      field[2].value = TYPE_INT;
+      type[0].size = 4;          // bitWidth
+      type[0].value = 64;
+      type[1].size = 1;          // is_signed
+      type[1].value = 1;
+      num_type_fields = 2;
+      break;
+    case ARROW_FLOAT64:
+      field[2].value = TYPE_FLOATINGPOINT;
+      type[0].size = 2;          // precision
+      type[0].value = PRECISION_DOUBLE;
+      num_type_fields = 1;
+      break;
+    case ARROW_UTF8:
+      field[2].value = TYPE_UTF8;
+      break;
+    case ARROW_BOOL:
+      field[2].value = TYPE_BOOL;
+      break;
+    }
+    fb_point(&fb, fields + 4*i, fb_table(&fb, field, 6));
+    fb_string(&fb, field[0].slot, w->columns[i].name);
+    fb_point(&fb, field[3].slot, fb_table(&fb, type, num_type_fields));
+    fb_vector(&fb, field[5].slot, 0, 4);
+  }
+  ok = write_message(w, &fb);
+  free(fb.data);
+  return ok;
+}
+
+// Writes the current batch as a record batch message, whose body is
+// the columns' buffers, each padded to 8 bytes, and starts a new
+// batch. A column without NULLs gets an empty validity buffer.
+static int write_batch(arrow_writer* w) {
+  static const char pad[8];
+  fbuf          fb = {NULL, 0, 0};
+  int           num_buffers = 0, rows = w->rows;
+  const void    **buffers = malloc(3 * w->num_columns * sizeof(void*) + 1);
+  size_t        *lengths = malloc(3 * w->num_columns * sizeof(size_t) + 1);
+  size_t        offset = 0, nodes, positions;
+  int           i, ok;
+  fbfield       message[4] = {{2, METADATA_V5}, {1, HEADER_RECORDBATCH}, {FB_OFFSET}, {8, 0}};
+  fbfield       batch[3] = {{8, rows}, {FB_OFFSET}, {FB_OFFSET}};   // length, nodes, buffers
+
+  for (i = 0; i < w->num_columns; i++) {
+    arrow_column *col = &w->columns[i];
+
+    buffers[num_buffers] = col->validity;
+    lengths[num_buffers++] = col->null_count > 0 ? (rows + 7) / 8 : 0;
+    switch (col->type) {
+    case ARROW_INT64:
+    case ARROW_FLOAT64:
+      buffers[num_buffers] = col->values;
+      lengths[num_buffers++] = (size_t) rows * 8;
+      break;
+    case ARROW_BOOL:
+      buffers[num_buffers] = col->values;
+      lengths[num_buffers++] = (rows + 7) / 8;
+      break;
+    case ARROW_UTF8:
+      buffers[num_buffers] = col->offsets;
+      lengths[num_buffers++] = (size_t) (rows + 1) * sizeof(int);
+      buffers[num_buffers] = col->data;
+      lengths[num_buffers++] = col->offsets[rows];
+      break;
+    }
+  }
+  for (i = 0; i < num_buffers; i++)
+    message[3].value += (lengths[i] + 7) / 8 * 8;
+
+  fb_zeros(&fb, 4);
+  fb_point(&fb, 0, fb_table(&fb, message, 4));
+  fb_point(&fb, message[2].slot, fb_table(&fb, batch, 3));
+  nodes = fb_vector(&fb, batch[1].slot, w->num_columns, 16);
+  for (i = 0; i < w->num_columns; i++) {
+    fb_put(&fb, nodes + 16*i, rows, 8);
+    fb_put(&fb, nodes + 16*i + 8, w->columns[i].null_count, 8);
+  }
+  positions = fb_vector(&fb, batch[2].slot, num_buffers, 16);
+  for (i = 0; i < num_buffers; i++) {
+    fb_put(&fb, positions + 16*i, offset, 8);
+    fb_put(&fb, positions + 16*i + 8, lengths[i], 8);
+    offset += (lengths[i] + 7) / 8 * 8;
+  }
+  ok = write_message(w, &fb);
+  for (i = 0; i < num_buffers; i++) {
+    write_bytes(w, buffers[i], lengths[i]);
+    write_bytes(w, pad, (8 - lengths[i] % 8) % 8);
+  }
+  if (ferror(w->fp))
+    ok = -1;
+
+  // Start the next batch empty.
+  for (i = 0; i < w->num_columns; i++) {
+    arrow_column *col = &w->columns[i];
+
+    memset(col->validity, 0, (rows + 7) / 8);
+    if (col->type == ARROW_BOOL)
+      memset(col->values, 0, (rows + 7) / 8);
+    col->null_count = 0;
+  }
+  w->rows = 0;
+  free(fb.data);
+  free(buffers);
+  free(lengths);
+  return ok;
+}
+
+// Writes a message's metadata, after the continuation marker and the
+// metadata length, padding it to 8 bytes.
+static int write_message(arrow_writer* w, fbuf* fb) {
+  unsigned char prefix[8];
+  int           i;
+
+  fb_align(fb, 8);
+  for (i = 0; i < 4; i++) {
+    prefix[i] = (unsigned char) (CONTINUATION >> 8*i);
+    prefix[4+i] = (unsigned char) (fb->length >> 8*i);
+  }
+  write_bytes(w, prefix, sizeof(prefix));
+  write_bytes(w, fb->data, fb->length);
+  return ferror(w->fp) ? -1 : 0;
+}
+
+// Writes bytes of the stream, counting them.
+static void write_bytes(arrow_writer* w, const void* bytes, size_t n) {
+  fwrite(bytes, 1, n, w->fp);
+  w->bytes += n;
+}
+
+/*
+** FlatBuffers
+*/
+
+// Appends n zero bytes, returning their position.
+static size_t fb_zeros(fbuf* fb, size_t n) {
+  size_t pos = fb->length;
+
+  if (fb->length + n > fb->size) {
+    while (fb->length + n > fb->size)
+      fb->size = fb->size > 0 ? 2 * fb->size : 1024;
+    fb->data = realloc(fb->data, fb->size);
+  }
+  memset(fb->data + pos, 0, n);
+  fb->length += n;
+  return pos;
+}
+
+// Pads the buffer to a multiple of align bytes, returning its length.
+static size_t fb_align(fbuf* fb, size_t align) {
+  if (fb->length % align != 0)
+    fb_zeros(fb, align - fb->length % align);
+  return fb->length;
+}
+
+// Stores a little-endian scalar.
+static void fb_put(fbuf* fb, size_t pos, unsigned long long value, int size) {
+  int i;
+
+  for (i = 0; i < size; i++, value >>= 8)
+    fb->data[pos+i] = (unsigned char) value;
+}
+
+// Fills in an offset slot, pointing it at a later object.
+static void fb_point(fbuf* fb, size_t slot, size_t target) {
+  fb_put(fb, slot, target - slot, 4);
+}
+
+// Writes a table, preceded by its vtable, and returns its position.
+// The table is aligned to 8 bytes, and each field within it to its
+// own size.
+static size_t fb_table(fbuf* fb, fbfield* fields, int num_fields) {
+  size_t vtable, table;
+  int    i, size, table_size = 4;
+  int    offsets[16];
+
+  for (i = 0; i < num_fields; i++) {
+    size = fields[i].size == FB_OFFSET ? 4 : fields[i].size;
+    offsets[i] = 0;
+    if (size == 0)
+      continue;
+    table_size = (table_size + size - 1) / size * size;
+    offsets[i] = table_size;
+    table_size += size;
+  }
+
+  fb_align(fb, 2);
+  vtable = fb_zeros(fb, 4 + 2*num_fields);
+  fb_put(fb, vtable, 4 + 2*num_fields, 2);
+  fb_put(fb, vtable + 2, table_size, 2);
+  for (i = 0; i < num_fields; i++)
+    fb_put(fb, vtable + 4 + 2*i, offsets[i], 2);
+
+  fb_align(fb, 8);
+  table = fb_zeros(fb, table_size);
+  fb_put(fb, table, table - vtable, 4);
+  for (i = 0; i < num_fields; i++) {
+    if (fields[i].size == FB_OFFSET)
+      fields[i].slot = table + offsets[i];
+    else if (fields[i].size > 0)
+      fb_put(fb, table + offsets[i], fields[i].value, fields[i].size);
+  }
+  return table;
+}
+
+// Writes a vector of count zeroed elements, pointing slot at it, and
+// returns the position of the first element. Elements of 8 bytes or
+// more are aligned to 8 bytes.
+static size_t fb_vector(fbuf* fb, size_t slot, int count, int element_size) {
+  size_t pos = fb_align(fb, 4);
+
+  if (element_size >= 8 && pos % 8 == 0)
+    fb_zeros(fb, 4);
+  pos = fb_zeros(fb, 4 + (size_t) count * element_size);
+  fb_put(fb, pos, count, 4);
+  fb_point(fb, slot, pos);
+  return pos + 4;
+}
+
+// Writes a NUL-terminated string, pointing slot at it.
+static void fb_string(fbuf* fb, size_t slot, const char* s) {
+  size_t n = strlen(s), pos;
+
+  fb_align(fb, 4);
+  pos = fb_zeros(fb, 4 + n + 1);
+  fb_put(fb, pos, n, 4);
+  memcpy(fb->data + pos + 4, s, n);
+  fb_point(fb, slot, pos);
+}
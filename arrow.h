@@ -0,0 +1,55 @@
+#ifndef ARROW_H_INCLUDED
+#define ARROW_H_INCLUDED
+/*
+** arrow.h
+**
+** Writes tables as Apache Arrow IPC streams, without the Arrow
+** libraries. See arrow.c.
+*/
+
+#include <stdio.h>
+
+typedef enum {
+  ARROW_INT64,
+  ARROW_FLOAT64,
+  ARROW_UTF8,
+  ARROW_BOOL
+} arrow_type;
+
+/*
+** A column of the batch being built: a validity bitmap, and the
+** values (64-bit numbers, or bits for booleans), or for text the
+** offsets of the values in their concatenated bytes.
+*/
+
+typedef struct arrow_column_t {
+  char          *name;
+  arrow_type    type;
+  unsigned char *validity;
+  unsigned char *values;
+  int           *offsets;
+  char          *data;
+  size_t        data_size;
+  long long     null_count;
+} arrow_column;
+
+typedef struct arrow_writer_t {
+  FILE         *fp;
+  int          num_columns;
+  arrow_column *columns;
+  int          batch_rows;
+  int          rows;
+  long long    bytes;
+} arrow_writer;
+
+arrow_writer* arrow_open(FILE* fp, int num_columns, char** names,
+                         arrow_type* types, int batch_rows);
+void arrow_set_null(arrow_writer* w, int column);
+void arrow_set_int64(arrow_writer* w, int column, long long value);
+void arrow_set_float64(arrow_writer* w, int column, double value);
+void arrow_set_utf8(arrow_writer* w, int column, const char* value, int length);
+void arrow_set_bool(arrow_writer* w, int column, int value);
+int  arrow_end_row(arrow_writer* w);
+int  arrow_close(arrow_writer* w, long long* bytes);
+
+#endif /* ARROW_H_INCLUDED */
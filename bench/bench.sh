@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# bench.sh
+#
+# Benchmarks dbf2tsv and tsv2dbf end to end on synthetic data, and the
+# core dbf.c calls on their own. Run from the top directory, after
+# make, usually by "make bench". The data is set by these variables:
+#
+#   BENCH_ROWS     rows (default 1000000)
+#   BENCH_COLUMNS  columns (default 10)
+#   BENCH_TYPES    column types, cycled: s text, i integer, d decimal
+#                  (default sid)
+#   BENCH_WIDTH    greatest width of text values (default 20)
+#   BENCH_NULLS    ratio of NULL values (default 0.1)
+#   BENCH_SEED     random seed (default 1)
+#   BENCH_JOBS     threads for -j (default the number of CPUs)
+#   BENCH_DIR      directory for the data (default a temporary one)
+#
+# For each test, writes the wall and CPU seconds, the non-null values
+# per second, the MB of input per second and the peak resident set
+# size in KB, tab-separated. The core dbf.c tests count every value,
+# NULL or not.
+
+ROWS=${BENCH_ROWS:-1000000}
+COLUMNS=${BENCH_COLUMNS:-10}
+TYPES=${BENCH_TYPES:-sid}
+WIDTH=${BENCH_WIDTH:-20}
+NULLS=${BENCH_NULLS:-0.1}
+SEED=${BENCH_SEED:-1}
+JOBS=${BENCH_JOBS:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)}
+if [ -n "$BENCH_DIR" ]; then
+  DIR=$BENCH_DIR
+  mkdir -p "$DIR" || exit 1
+else
+  DIR=$(mktemp -d "${TMPDIR:-/tmp}/dbf2tsv-bench.XXXXXX") || exit 1
+  trap 'rm -rf "$DIR"' EXIT
+fi
+
+GEN="bench/dbfgen -r $ROWS -c $COLUMNS -t $TYPES -w $WIDTH -n $NULLS -s $SEED"
+$GEN > "$DIR/bench.tsv" 2> "$DIR/gen.log" || exit 1
+$GEN -o "$DIR/bench.dbf" 2> /dev/null || exit 1
+VALUES=$(sed -n 's/.*Non-null values: //p' "$DIR/gen.log")
+
+echo "# rows=$ROWS columns=$COLUMNS types=$TYPES width=$WIDTH nulls=$NULLS seed=$SEED jobs=$JOBS"
+echo "# $(uname -srm), $(getconf _NPROCESSORS_ONLN 2>/dev/null) CPUs, $VALUES non-null values"
+printf 'test\tseconds\tcpu\tvalues/s\tMB/s\tpeak_rss_kb\n'
+
+# run NAME INPUT COMMAND...: times a command reading INPUT.
+run() {
+  name=$1
+  bytes=$(wc -c < "$2")
+  shift 2
+  bench/timecmd -o "$DIR/out" "$@" 2> "$DIR/err" \
+    | awk -v name="$name" -v values="$VALUES" -v bytes="$bytes" -F '\t' \
+        '{ printf "%s\t%.3f\t%.3f\t%.0f\t%.1f\t%d\n", name, $1, $2 + $3,
+           values / $1, bytes / 1e6 / $1, $4 }'
+}
+
+run "tsv2dbf"             "$DIR/bench.tsv" ./tsv2dbf "$DIR/bench.tsv" "$DIR/out.dbf"
+run "tsv2dbf -j $JOBS"    "$DIR/bench.tsv" ./tsv2dbf -j "$JOBS" "$DIR/bench.tsv" "$DIR/out.dbf"
+run "dbf2tsv"             "$DIR/bench.dbf" ./dbf2tsv "$DIR/bench.dbf"
+run "dbf2tsv -r"          "$DIR/bench.dbf" ./dbf2tsv -r "$DIR/bench.dbf"
+run "dbf2tsv -j $JOBS"    "$DIR/bench.dbf" ./dbf2tsv -j "$JOBS" "$DIR/bench.dbf"
+run "dbf2tsv -a"          "$DIR/bench.dbf" ./dbf2tsv -a "$DIR/bench.dbf"
+
+bench/dbfbench "$DIR/bench.dbf" "$DIR/scratch.dbf"
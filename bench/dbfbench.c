@@ -0,0 +1,276 @@
+/*
+** dbfbench.c
+**
+** Times the core dbf.c calls on their own, without any formatting or
+** parsing around them: reading each record, or each value of each
+** record, of a DBF file in several ways, and writing them again to a
+** scratch DBF file. For each test, writes on stdout the wall and CPU
+** seconds taken, the values (calls for each field of each record) per
+** second, the MB of records per second and the peak resident set size
+** so far in KB, tab-separated.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "dbf.h"
+
+#define USAGE "Usage: dbfbench [-m access] dbf-file scratch-dbf-file\n"
+
+/*
+** A test: a name, and a function running it over a DBF file (and the
+** scratch DBF file, for writing tests), returning a checksum so that
+** the calls can't be optimized away.
+*/
+
+typedef struct test_t {
+  const char *name;
+  double     (*run)(DBFHandle dbf_file, DBFHandle scratch_file);
+} test;
+
+/*
+** Forward declarations
+*/
+
+double read_tuple(DBFHandle dbf_file, DBFHandle scratch_file);
+double read_string(DBFHandle dbf_file, DBFHandle scratch_file);
+double read_double(DBFHandle dbf_file, DBFHandle scratch_file);
+double field_view(DBFHandle dbf_file, DBFHandle scratch_file);
+double scan_block(DBFHandle dbf_file, DBFHandle scratch_file);
+double write_attribute(DBFHandle dbf_file, DBFHandle scratch_file);
+double write_tuple(DBFHandle dbf_file, DBFHandle scratch_file);
+double append_block(DBFHandle dbf_file, DBFHandle scratch_file);
+double append_tuple(DBFHandle dbf_file, DBFHandle scratch_file);
+double now(void);
+double cpu_seconds(struct rusage* usage);
+
+static const test tests[] = {
+  {"DBFReadTuple",             read_tuple},
+  {"DBFReadStringAttribute",   read_string},
+  {"DBFReadDoubleAttribute",   read_double},
+  {"DBFGetFieldView",          field_view},
+  {"DBFScanNextBlock",         scan_block},
+  {"DBFWrite*Attribute",       write_attribute},
+  {"DBFWriteTuple",            write_tuple},
+  {"DBFAppendRecordBlock",     append_block},
+  {"DBFSetTuple*/AppendTuple", append_tuple}
+};
+
+/*
+** Main
+*/
+
+int main(int argc, char **argv){
+  DBFHandle     dbf_file, scratch_file;
+  struct rusage usage;
+  char          *access = "rb";
+  int           i, opt;
+  double        start, start_cpu, elapsed, values, megabytes, checksum = 0;
+
+  while ((opt = getopt(argc, argv, "m:")) != -1) {
+    switch (opt) {
+    case 'm':
+      access = optarg;
+      break;
+    default:
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  if (argc-optind != 2) {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); i++) {
+    // Each test has the DBF file, and a new scratch file, to itself.
+    dbf_file = DBFOpen(argv[optind], access);
+    if (dbf_file == NULL) {
+      fprintf(stderr, "%s can't be read or is not a DBF file\n", argv[optind]);
+      return EXIT_FAILURE;
+    }
+    scratch_file = DBFCloneEmpty(dbf_file, argv[optind+1]);
+    if (scratch_file == NULL) {
+      fprintf(stderr, "%s file cannot be created\n", argv[optind+1]);
+      return EXIT_FAILURE;
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    start_cpu = cpu_seconds(&usage);
+    start = now();
+    checksum += tests[i].run(dbf_file, scratch_file);
+    DBFClose(scratch_file);
+    elapsed = now() - start;
+
+    values = (double) DBFGetRecordCount64(dbf_file) * DBFGetFieldCount(dbf_file);
+    megabytes = (double) DBFGetRecordCount64(dbf_file) * DBFGetRecordLength(dbf_file) / 1e6;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%s\t%.3f\t%.3f\t%.0f\t%.1f\t%ld\n", tests[i].name, elapsed,
+           cpu_seconds(&usage) - start_cpu, values / elapsed, megabytes / elapsed,
+           usage.ru_maxrss);
+    fflush(stdout);
+    DBFClose(dbf_file);
+  }
+  unlink(argv[optind+1]);
+  return checksum == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Reads each record with DBFReadTuple.
+double read_tuple(DBFHandle dbf_file, DBFHandle scratch_file) {
+  int64_t i, n = DBFGetRecordCount64(dbf_file);
+  double  sum = 0;
+
+  for (i = 0; i < n; i++)
+    sum += DBFReadTuple64(dbf_file, i)[0];
+  return sum;
+}
+
+// Reads each value with DBFReadStringAttribute.
+double read_string(DBFHandle dbf_file, DBFHandle scratch_file) {
+  int64_t i, n = DBFGetRecordCount64(dbf_file);
+  int     j, num_fields = DBFGetFieldCount(dbf_file);
+  double  sum = 0;
+
+  for (i = 0; i < n; i++)
+    for (j = 0; j < num_fields; j++)
+      sum += DBFReadStringAttribute64(dbf_file, i, j)[0];
+  return sum;
+}
+
+// Reads each value with DBFReadDoubleAttribute, whatever its type.
+double read_double(DBFHandle dbf_file, DBFHandle scratch_file) {
+  int64_t i, n = DBFGetRecordCount64(dbf_file);
+  int     j, num_fields = DBFGetFieldCount(dbf_file);
+  double  sum = 0;
+
+  for (i = 0; i < n; i++)
+    for (j = 0; j < num_fields; j++)
+      sum += DBFReadDoubleAttribute64(dbf_file, i, j);
+  return sum;
+}
+
+// Reads each value in place with DBFGetFieldView.
+double field_view(DBFHandle dbf_file, DBFHandle scratch_file) {
+  int64_t    i, n = DBFGetRecordCount64(dbf_file);
+  int        j, length, num_fields = DBFGetFieldCount(dbf_file);
+  const char *value;
+  double     sum = 0;
+
+  for (i = 0; i < n; i++)
+    for (j = 0; j < num_fields; j++)
+      if (DBFGetFieldView64(dbf_file, i, j, &value, &length))
+        sum += length;
+  return sum;
+}
+
+// Reads the records a block at a time with a scan, and each value in
+// place with DBFGetTupleFieldView.
+double scan_block(DBFHandle dbf_file, DBFHandle scratch_file) {
+  DBFScanHandle scan = DBFScanOpen64(dbf_file, 0, -1, 0);
+  int           i, j, length, num_records, num_fields = DBFGetFieldCount(dbf_file);
+  int           record_length = DBFGetRecordLength(dbf_file);
+  int64_t       first_record;
+  const char    *block, *value;
+  double        sum = 0;
+
+  while (scan != NULL
+         && (block = DBFScanNextBlock64(scan, &first_record, &num_records)) != NULL)
+    for (i = 0; i < num_records; i++)
+      for (j = 0; j < num_fields; j++) {
+        DBFGetTupleFieldView(dbf_file, block + (size_t) i * record_length, j, &value, &length);
+        sum += length;
+      }
+  DBFScanClose(scan);
+  return sum;
+}
+
+// Copies each value to the scratch file with the DBFWrite*Attribute
+// function for its type.
+double write_attribute(DBFHandle dbf_file, DBFHandle scratch_file) {
+  int64_t      i, n = DBFGetRecordCount64(dbf_file);
+  int          j, num_fields = DBFGetFieldCount(dbf_file);
+  DBFFieldType type;
+
+  for (i = 0; i < n; i++)
+    for (j = 0; j < num_fields; j++) {
+      type = DBFGetFieldInfo(dbf_file, j, NULL, NULL, NULL);
+      if (DBFIsAttributeNULL64(dbf_file, i, j))
+        DBFWriteNULLAttribute64(scratch_file, i, j);
+      else if (type == FTInteger)
+        DBFWriteIntegerAttribute64(scratch_file, i, j, DBFReadIntegerAttribute64(dbf_file, i, j));
+      else if (type == FTDouble)
+        DBFWriteDoubleAttribute64(scratch_file, i, j, DBFReadDoubleAttribute64(dbf_file, i, j));
+      else
+        DBFWriteStringAttribute64(scratch_file, i, j, DBFReadStringAttribute64(dbf_file, i, j));
+    }
+  return 0;
+}
+
+// Copies each record to the scratch file with DBFWriteTuple.
+double write_tuple(DBFHandle dbf_file, DBFHandle scratch_file) {
+  int64_t i, n = DBFGetRecordCount64(dbf_file);
+
+  for (i = 0; i < n; i++)
+    DBFWriteTuple64(scratch_file, i, (void *) DBFReadTuple64(dbf_file, i));
+  return 0;
+}
+
+// Copies the records to the scratch file a block at a time, as read by
+// a scan, with DBFAppendRecordBlock.
+double append_block(DBFHandle dbf_file, DBFHandle scratch_file) {
+  DBFScanHandle scan = DBFScanOpen64(dbf_file, 0, -1, 0);
+  int           num_records;
+  int64_t       first_record;
+  const char    *block;
+
+  while (scan != NULL
+         && (block = DBFScanNextBlock64(scan, &first_record, &num_records)) != NULL)
+    DBFAppendRecordBlock(scratch_file, block, num_records);
+  DBFScanClose(scan);
+  return 0;
+}
+
+// Copies each value to a record built with the DBFSetTuple function for
+// its type, and appends the records to the scratch file with
+// DBFAppendTuple.
+double append_tuple(DBFHandle dbf_file, DBFHandle scratch_file) {
+  int64_t      i, n = DBFGetRecordCount64(dbf_file);
+  int          j, num_fields = DBFGetFieldCount(dbf_file);
+  char         *record = malloc(DBFGetRecordLength(scratch_file));
+  DBFFieldType type;
+
+  for (i = 0; i < n; i++) {
+    DBFBlankTuple(scratch_file, record);
+    for (j = 0; j < num_fields; j++) {
+      type = DBFGetFieldInfo(dbf_file, j, NULL, NULL, NULL);
+      if (DBFIsAttributeNULL64(dbf_file, i, j))
+        DBFSetTupleNULLAttribute(scratch_file, record, j);
+      else if (type == FTInteger)
+        DBFSetTupleIntegerAttribute(scratch_file, record, j, DBFReadIntegerAttribute64(dbf_file, i, j));
+      else if (type == FTDouble)
+        DBFSetTupleDoubleAttribute(scratch_file, record, j, DBFReadDoubleAttribute64(dbf_file, i, j));
+      else
+        DBFSetTupleStringAttribute(scratch_file, record, j, DBFReadStringAttribute64(dbf_file, i, j));
+    }
+    DBFAppendTuple(scratch_file, record);
+  }
+  free(record);
+  return 0;
+}
+
+// The time in seconds, from a monotonic clock.
+double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The user and system CPU time in a resource usage, in seconds.
+double cpu_seconds(struct rusage* usage) {
+  return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6
+    + usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+}
@@ -0,0 +1,150 @@
+/*
+** dbfgen.c
+**
+** Generates synthetic data for the benchmarks: a TSV file, written on
+** stdout, or (with -o) a DBF file, of random rows with a given number
+** of columns, mix of types, text width and ratio of NULL (empty)
+** values. The same seed always gives the same data.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dbf.h"
+
+#define FS '\t'
+#define RS '\n'
+#define INTEGER_WIDTH 10
+#define DOUBLE_WIDTH  12
+#define DOUBLE_DECIMALS 2
+#define USAGE "Usage: dbfgen [-r rows] [-c columns] [-t types] [-w width] [-n null-ratio] [-s seed] [-o dbf-file]\n"
+
+/*
+** Forward declarations
+*/
+
+uint64_t next_random(uint64_t* state);
+int      make_value(uint64_t* state, char type, int width, double nulls, char* value);
+
+/*
+** Main
+*/
+
+int main(int argc, char **argv){
+  DBFHandle dbf_file = NULL;
+  char      *types = "sid", *dbf_filename = NULL, *value, *record = NULL, name[12];
+  int       i, j, opt, num_columns = 10, width = 20, length;
+  int64_t   num_rows = 100000, num_values = 0;
+  double    nulls = 0.1;
+  uint64_t  state = 1;
+
+  while ((opt = getopt(argc, argv, "r:c:t:w:n:s:o:")) != -1) {
+    switch (opt) {
+    case 'r': num_rows = atoll(optarg); break;
+    case 'c': num_columns = atoi(optarg); break;
+    case 't': types = optarg; break;
+    case 'w': width = atoi(optarg); break;
+    case 'n': nulls = atof(optarg); break;
+    case 's': state = strtoull(optarg, NULL, 10); break;
+    case 'o': dbf_filename = optarg; break;
+    default:
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc || num_columns < 1 || width < 1 || types[strspn(types, "sid")] != '\0') {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+  state = state * 0x9e3779b97f4a7c15ULL + 1;
+
+  // Column j has type types[j % strlen(types)]: s for text, i for
+  // integers, d for decimals.
+  if (dbf_filename != NULL) {
+    dbf_file = DBFCreate(dbf_filename);
+    if (dbf_file == NULL) {
+      fprintf(stderr, "%s file cannot be created\n", dbf_filename);
+      return EXIT_FAILURE;
+    }
+  }
+  for (j = 0; j < num_columns; j++) {
+    char type = types[j % strlen(types)];
+    sprintf(name, "%c%d", type == 's' ? 'S' : type == 'i' ? 'I' : 'D', j);
+    if (dbf_file == NULL)
+      printf("%s%c", name, j + 1 < num_columns ? FS : RS);
+    else if (type == 's')
+      DBFAddField(dbf_file, name, FTString, width, 0);
+    else if (type == 'i')
+      DBFAddField(dbf_file, name, FTInteger, INTEGER_WIDTH, 0);
+    else
+      DBFAddField(dbf_file, name, FTDouble, DOUBLE_WIDTH, DOUBLE_DECIMALS);
+  }
+
+  // DBF records are built in record, and appended a block at a time.
+  value = malloc(width + 32);
+  if (dbf_file != NULL)
+    record = malloc(DBFGetRecordLength(dbf_file));
+  for (i = 0; i < num_rows; i++) {
+    if (dbf_file != NULL)
+      DBFBlankTuple(dbf_file, record);
+    for (j = 0; j < num_columns; j++) {
+      char type = types[j % strlen(types)];
+      length = make_value(&state, type, width, nulls, value);
+      num_values += length > 0;
+      if (dbf_file == NULL) {
+        fwrite(value, 1, length, stdout);
+        putchar(j + 1 < num_columns ? FS : RS);
+      } else if (length == 0) {
+        DBFSetTupleNULLAttribute(dbf_file, record, j);
+      } else if (type == 's') {
+        DBFSetTupleStringAttribute(dbf_file, record, j, value);
+      } else if (type == 'i') {
+        DBFSetTupleIntegerAttribute(dbf_file, record, j, atoi(value));
+      } else {
+        DBFSetTupleDoubleAttribute(dbf_file, record, j, atof(value));
+      }
+    }
+    if (dbf_file != NULL)
+      DBFAppendTuple(dbf_file, record);
+  }
+  free(value);
+  free(record);
+  if (dbf_file != NULL)
+    DBFClose(dbf_file);
+  fprintf(stderr, "Data rows: %lld, Non-null values: %lld\n",
+          (long long) num_rows, (long long) num_values);
+  return EXIT_SUCCESS;
+}
+
+// A value of the given type in value, NUL-terminated, returning its
+// length, which is 0 for a NULL value. Numbers aren't negative, as
+// tsv2dbf takes a minus sign to make a value text.
+int make_value(uint64_t* state, char type, int width, double nulls, char* value) {
+  int i, length;
+
+  if ((next_random(state) >> 11) * (1.0 / 9007199254740992.0) < nulls) {
+    value[0] = '\0';
+    return 0;
+  }
+  switch (type) {
+  case 'i':
+    return sprintf(value, "%d", (int) (next_random(state) % 1000000000));
+  case 'd':
+    return sprintf(value, "%.2f", (double) (next_random(state) % 100000000) / 100);
+  default:
+    length = 1 + next_random(state) % width;
+    for (i = 0; i < length; i++)
+      value[i] = 'a' + next_random(state) % 26;
+    value[length] = '\0';
+    return length;
+  }
+}
+
+// The next number from a xorshift64* generator.
+uint64_t next_random(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dULL;
+}
@@ -0,0 +1,80 @@
+/*
+** timecmd.c
+**
+** Runs a command for the benchmarks, with its standard output going to
+** a file (by default /dev/null), and then writes on stdout the wall
+** time, user and system CPU time in seconds, and peak resident set
+** size in KB of the command, tab-separated. Exits with the command's
+** status.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define USAGE "Usage: timecmd [-o output-file] command [argument]...\n"
+
+/*
+** Forward declarations
+*/
+
+double seconds(struct timeval tv);
+
+/*
+** Main
+*/
+
+int main(int argc, char **argv){
+  char           *output = "/dev/null";
+  struct timeval start, end;
+  struct rusage  usage;
+  int            opt, fd, status;
+  pid_t          pid;
+
+  while ((opt = getopt(argc, argv, "+o:")) != -1) {
+    switch (opt) {
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+
+  gettimeofday(&start, NULL);
+  pid = fork();
+  if (pid == 0) {
+    fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+      perror(output);
+      _exit(127);
+    }
+    close(fd);
+    execvp(argv[optind], argv + optind);
+    perror(argv[optind]);
+    _exit(127);
+  }
+  if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+    perror("timecmd");
+    return EXIT_FAILURE;
+  }
+  gettimeofday(&end, NULL);
+
+  printf("%.3f\t%.3f\t%.3f\t%ld\n", seconds(end) - seconds(start),
+         seconds(usage.ru_utime), seconds(usage.ru_stime), usage.ru_maxrss);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
+
+// A time in seconds.
+double seconds(struct timeval tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
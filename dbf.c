@@ -23,13 +23,29 @@
  *
  ******************************************************************************/
 
+/* Use 64-bit file offsets (off_t, fseeko) on 32-bit systems too. */
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include "dbf.h"
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+  && !defined(DBF_DISABLE_SIMD)
+#define DBF_X86_SIMD
+#include <immintrin.h>
+#endif
 
 #ifndef FALSE
 #define FALSE       0
@@ -38,10 +54,158 @@
 
 #define XBASE_FLDHDR_SZ 32
 
+/* The header holds the record count in 32 bits. */
+#define DBF_MAX_RECORDS 0xFFFFFFFFLL
+
+/* Default size in bytes of the blocks of records read by read-only */
+/* handles and by the DBFScan functions. */
+#define DBF_BLOCK_SIZE (1024 * 1024)
+
+/* Number of block buffers of a scan with read-ahead: one for the */
+/* caller, and the rest for the reader thread to fill ahead of it. */
+#define DBF_READ_AHEAD 3
+
+/* Read-ahead state of a scan of a read-only stdio handle.  A reader */
+/* thread reads the scan's blocks in order into a ring of buffers, so */
+/* that the next blocks are read while the caller works on this one. */
+/* Block k goes in buffer k % DBF_READ_AHEAD. */
+typedef struct DBFReadAheadInfo {
+  pthread_t       hThread;
+  pthread_mutex_t sLock;
+  pthread_cond_t  sCond;
+  char            *apachBuffer[DBF_READ_AHEAD];
+  int             anRecords[DBF_READ_AHEAD];
+  int64_t         iFirstRecord;
+  int64_t         nBlocks;
+  int64_t         nRead;
+  int64_t         nTaken;
+  int             bFinished;
+  int             bFailed;
+  int             bStop;
+} DBFReadAheadInfo;
+
 static void *SfRealloc(void *pMem, int nNewSize) {
   return (void *) (pMem == NULL ? malloc(nNewSize) : realloc(pMem, nNewSize));
 }
 
+/*
+** Blank-scanning kernels.  DBF fields are fixed-width and space padded,
+** so trimming and NULL checks mostly come down to finding the first
+** or last non-blank byte.  The SSE2 and AVX2 versions compare 16 or 32
+** bytes at a time; the best one the CPU supports is picked once, at
+** the first DBFOpen or DBFCreate.  Fields shorter than a vector use
+** the scalar loops directly.  Define DBF_DISABLE_SIMD to build with
+** only the scalar loops.
+*/
+
+/* DBFSpanBlanksScalar */
+static int DBFSpanBlanksScalar(const char *pach, int n) {
+  int i = 0;
+  while (i < n && pach[i] == ' ')
+    i++;
+  return i;
+}
+
+/* DBFSpanTrailingBlanksScalar */
+static int DBFSpanTrailingBlanksScalar(const char *pach, int n) {
+  int i = n;
+  while (i > 0 && pach[i - 1] == ' ')
+    i--;
+  return n - i;
+}
+
+#ifdef DBF_X86_SIMD
+/* DBFSpanBlanksSSE2 */
+__attribute__((target("sse2")))
+static int DBFSpanBlanksSSE2(const char *pach, int n) {
+  const __m128i blanks = _mm_set1_epi8(' ');
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    unsigned int mask = _mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (pach + i)), blanks));
+    if (mask != 0xFFFF)
+      return i + __builtin_ctz(~mask);
+  }
+  return i + DBFSpanBlanksScalar(pach + i, n - i);
+}
+
+/* DBFSpanTrailingBlanksSSE2 */
+__attribute__((target("sse2")))
+static int DBFSpanTrailingBlanksSSE2(const char *pach, int n) {
+  const __m128i blanks = _mm_set1_epi8(' ');
+  int i;
+
+  for (i = n; i >= 16; i -= 16) {
+    unsigned int mask = _mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (pach + i - 16)), blanks));
+    if (mask != 0xFFFF)
+      return n - (i - 16) - (32 - __builtin_clz(~mask & 0xFFFF));
+  }
+  return n - i + DBFSpanTrailingBlanksScalar(pach, i);
+}
+
+/* DBFSpanBlanksAVX2 */
+__attribute__((target("avx2")))
+static int DBFSpanBlanksAVX2(const char *pach, int n) {
+  const __m256i blanks = _mm256_set1_epi8(' ');
+  int i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    unsigned int mask = _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (pach + i)), blanks));
+    if (mask != 0xFFFFFFFFu)
+      return i + __builtin_ctz(~mask);
+  }
+  return i + DBFSpanBlanksSSE2(pach + i, n - i);
+}
+
+/* DBFSpanTrailingBlanksAVX2 */
+__attribute__((target("avx2")))
+static int DBFSpanTrailingBlanksAVX2(const char *pach, int n) {
+  const __m256i blanks = _mm256_set1_epi8(' ');
+  int i;
+
+  for (i = n; i >= 32; i -= 32) {
+    unsigned int mask = _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (pach + i - 32)), blanks));
+    if (mask != 0xFFFFFFFFu)
+      return n - (i - 32) - (32 - __builtin_clz(~mask));
+  }
+  return n - i + DBFSpanTrailingBlanksSSE2(pach, i);
+}
+#endif
+
+static int (*pfnSpanBlanks)(const char *, int) = DBFSpanBlanksScalar;
+static int (*pfnSpanTrailingBlanks)(const char *, int) = DBFSpanTrailingBlanksScalar;
+static pthread_once_t sKernelsOnce = PTHREAD_ONCE_INIT;
+
+/* DBFInitKernels */
+static void DBFInitKernels(void) {
+#ifdef DBF_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    pfnSpanBlanks = DBFSpanBlanksAVX2;
+    pfnSpanTrailingBlanks = DBFSpanTrailingBlanksAVX2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    pfnSpanBlanks = DBFSpanBlanksSSE2;
+    pfnSpanTrailingBlanks = DBFSpanTrailingBlanksSSE2;
+  }
+#endif
+}
+
+/* DBFSpanBlanks */
+/* Returns the number of leading blanks in pach[0..n). */
+static int DBFSpanBlanks(const char *pach, int n) {
+  return n < 16 ? DBFSpanBlanksScalar(pach, n) : pfnSpanBlanks(pach, n);
+}
+
+/* DBFSpanTrailingBlanks */
+/* Returns the number of trailing blanks in pach[0..n). */
+static int DBFSpanTrailingBlanks(const char *pach, int n) {
+  return n < 16 ? DBFSpanTrailingBlanksScalar(pach, n) : pfnSpanTrailingBlanks(pach, n);
+}
+
 static void DBFWriteHeader(DBFHandle psDBF) {
   unsigned char abyHeader[XBASE_FLDHDR_SZ];
   int i;
@@ -79,44 +243,124 @@ static void DBFWriteHeader(DBFHandle psDBF) {
   }
 }
 
+/* DBFCountIO */
+/* Adds to one of the I/O counts of a handle.  Scans read ahead on a */
+/* thread of their own, and threads may share a read-only handle, so */
+/* the counts are added atomically. */
+static void DBFCountIO(int64_t *pnCount, int64_t nAdd) {
+  __atomic_fetch_add(pnCount, nAdd, __ATOMIC_RELAXED);
+}
+
+/* DBFFlushAppends */
+/* Writes the records gathered by DBFAppendTuple, which are the last */
+/* ones counted, with a single write. */
+static int DBFFlushAppends(DBFHandle psDBF) {
+  int nRecords = psDBF->nAppendRecords;
+  int64_t iFirstRecord = psDBF->nRecords - nRecords;
+  off_t nRecordOffset;
+
+  if (nRecords == 0)
+    return TRUE;
+  psDBF->nAppendRecords = 0;
+  nRecordOffset = psDBF->nRecordLength * (off_t) iFirstRecord + psDBF->nHeaderLength;
+  DBFCountIO(&psDBF->sIOStats.nSeeks, 1);
+  DBFCountIO(&psDBF->sIOStats.nWrites, 1);
+  if (fseeko(psDBF->fp, nRecordOffset, SEEK_SET) != 0
+      || fwrite(psDBF->pachAppendBlock, psDBF->nRecordLength, nRecords, psDBF->fp) != (size_t) nRecords) {
+    fprintf(stderr, "Failure writing DBF records %lld to %lld.\n",
+            (long long) iFirstRecord, (long long) psDBF->nRecords - 1);
+    return FALSE;
+  }
+  DBFCountIO(&psDBF->sIOStats.nBytesWritten, (int64_t) nRecords * psDBF->nRecordLength);
+  psDBF->bUpdated = TRUE;
+  return TRUE;
+}
+
 /* DBFFlushRecord */
+/* Writes the current record if it was modified, after any records */
+/* gathered by DBFAppendTuple, which come before it. */
 static int DBFFlushRecord(DBFHandle psDBF) {
-  unsigned long nRecordOffset;
+  off_t nRecordOffset;
 
+  if (!DBFFlushAppends(psDBF))
+    return FALSE;
   if (psDBF->bCurrentRecordModified && psDBF->nCurrentRecord > -1) {
     psDBF->bCurrentRecordModified = FALSE;
-    nRecordOffset = psDBF->nRecordLength * (unsigned long) psDBF->nCurrentRecord
+    nRecordOffset = psDBF->nRecordLength * (off_t) psDBF->nCurrentRecord
       + psDBF->nHeaderLength;
-    if (fseek(psDBF->fp, nRecordOffset, 0) != 0
+    DBFCountIO(&psDBF->sIOStats.nSeeks, 1);
+    DBFCountIO(&psDBF->sIOStats.nWrites, 1);
+    if (fseeko(psDBF->fp, nRecordOffset, 0) != 0
         || fwrite(psDBF->pszCurrentRecord,psDBF->nRecordLength, 1, psDBF->fp) != 1) {
       char szMessage[128];
-      sprintf(szMessage, "Failure writing DBF record %d.", psDBF->nCurrentRecord);
+      sprintf(szMessage, "Failure writing DBF record %lld.", (long long) psDBF->nCurrentRecord);
       fprintf(stderr, szMessage);
       return FALSE;
     }
+    DBFCountIO(&psDBF->sIOStats.nBytesWritten, psDBF->nRecordLength);
   }
   return TRUE;
 }
 
 /* DBFLoadRecord */
-static int DBFLoadRecord(DBFHandle psDBF, int iRecord) {
+static int DBFLoadRecord(DBFHandle psDBF, int64_t iRecord) {
   if (psDBF->nCurrentRecord != iRecord) {
-    unsigned long nRecordOffset;
+    off_t nRecordOffset;
     char szMessage[128];
 
     if (!DBFFlushRecord(psDBF))
       return FALSE;
-    nRecordOffset = psDBF->nRecordLength * (unsigned long) iRecord + psDBF->nHeaderLength;
-    if (fseek(psDBF->fp, nRecordOffset, SEEK_SET) != 0) {
-      sprintf(szMessage, "fseek(%ld) failed on DBF file.\n",(long) nRecordOffset);
+    nRecordOffset = psDBF->nRecordLength * (off_t) iRecord + psDBF->nHeaderLength;
+
+    /* A mapped file needs no I/O: the record is a view into the mapping. */
+    if (psDBF->pabyMap != NULL) {
+      if (nRecordOffset + psDBF->nRecordLength > (off_t) psDBF->nMapSize) {
+        sprintf(szMessage, "Record %lld is beyond the end of the DBF file.\n", (long long) iRecord);
+        fprintf(stderr,szMessage);
+        return FALSE;
+      }
+      DBFCountIO(&psDBF->sIOStats.nBytesRead, psDBF->nRecordLength);
+      psDBF->pszCurrentRecord = (char *) psDBF->pabyMap + nRecordOffset;
+      psDBF->nCurrentRecord = iRecord;
+      return TRUE;
+    }
+
+    /* Read-only handles serve records out of a block.  Reading on from */
+    /* the end of the block fetches a whole new block; any other miss */
+    /* reads just the one record, so random access stays cheap. */
+    if (psDBF->bReadOnly) {
+      if (iRecord < psDBF->nBlockFirst
+          || iRecord >= psDBF->nBlockFirst + psDBF->nBlockRecords) {
+        int nWanted = 1, nRead;
+        if (iRecord == psDBF->nBlockFirst + psDBF->nBlockRecords)
+          nWanted = psDBF->nBlockCapacity;
+        nRead = DBFReadRecordBlock64(psDBF, iRecord, nWanted, psDBF->pachBlock);
+        if (nRead <= 0) {
+          psDBF->nBlockRecords = 0;
+          return FALSE;
+        }
+        psDBF->nBlockFirst = iRecord;
+        psDBF->nBlockRecords = nRead;
+      }
+      psDBF->pszCurrentRecord = psDBF->pachBlock
+        + (iRecord - psDBF->nBlockFirst) * psDBF->nRecordLength;
+      psDBF->nCurrentRecord = iRecord;
+      return TRUE;
+    }
+
+    DBFCountIO(&psDBF->sIOStats.nSeeks, 1);
+    if (fseeko(psDBF->fp, nRecordOffset, SEEK_SET) != 0) {
+      sprintf(szMessage, "fseeko(%lld) failed on DBF file.\n",(long long) nRecordOffset);
       fprintf(stderr,szMessage);
       return FALSE;
     }
+    DBFCountIO(&psDBF->sIOStats.nReads, 1);
     if (fread(psDBF->pszCurrentRecord,psDBF->nRecordLength, 1, psDBF->fp) != 1) {
       sprintf(szMessage, "fread(%d) failed on DBF file.\n",psDBF->nRecordLength);
       fprintf(stderr,szMessage);
       return FALSE;
     }
+    DBFCountIO(&psDBF->sIOStats.nBytesRead, psDBF->nRecordLength);
     psDBF->nCurrentRecord = iRecord;
   }
   return TRUE;
@@ -140,21 +384,26 @@ void  DBFUpdateHeader(DBFHandle psDBF) {
   fflush(psDBF->fp);
 }
 
+static DBFHandle DBFOpenHandle(FILE *fp, FILE *pfCPG, int bReadOnly, int bMap, int bStream);
+
 /* DBFOpen */
 DBFHandle  DBFOpen(const char *pszFilename, const char *pszAccess) {
-  DBFHandle psDBF;
-  FILE* pfCPG;
-  unsigned char *pabyBuf;
-  int nFields, nHeadLen, iField, i;
+  FILE *fp, *pfCPG;
+  int i;
   char *pszBasename, *pszFullname;
-  int nBufSize = 500;
+  int bMap = FALSE;
 
-  /* We only allow the access strings "rb" and "r+". */
+  /* We only allow the access strings "rb", "r+" and "rm" (read-only, */
+  /* memory-mapped). */
   if (strcmp(pszAccess, "r") != 0 && strcmp(pszAccess, "r+") != 0
       && strcmp(pszAccess, "rb") != 0 && strcmp(pszAccess, "rb+") != 0
-      && strcmp(pszAccess, "r+b") != 0)
+      && strcmp(pszAccess, "r+b") != 0 && strcmp(pszAccess, "rm") != 0)
     return (NULL);
 
+  if (strcmp(pszAccess, "rm") == 0) {
+    bMap = TRUE;
+    pszAccess = "rb";
+  }
   if (strcmp(pszAccess, "r") == 0)
     pszAccess = "rb";
   if (strcmp(pszAccess, "r+") == 0)
@@ -174,11 +423,10 @@ DBFHandle  DBFOpen(const char *pszFilename, const char *pszAccess) {
 
   pszFullname = (char *) malloc(strlen(pszBasename) + 5);
   sprintf(pszFullname, "%s.dbf", pszBasename);
-  psDBF = (DBFHandle) calloc(1, sizeof(DBFInfo));
-  psDBF->fp = fopen(pszFullname, pszAccess);
-  if (psDBF->fp == NULL) {
+  fp = fopen(pszFullname, pszAccess);
+  if (fp == NULL) {
     sprintf(pszFullname, "%s.DBF", pszBasename);
-    psDBF->fp = fopen(pszFullname, pszAccess);
+    fp = fopen(pszFullname, pszAccess);
   }
   sprintf(pszFullname, "%s.cpg", pszBasename);
   pfCPG = fopen(pszFullname, "r");
@@ -190,16 +438,42 @@ DBFHandle  DBFOpen(const char *pszFilename, const char *pszAccess) {
   free(pszBasename);
   free(pszFullname);
 
-  if (psDBF->fp == NULL) {
-    free(psDBF);
+  if (fp == NULL) {
     if (pfCPG)
       fclose(pfCPG);
     return (NULL);
   }
 
+  return DBFOpenHandle(fp, pfCPG, strchr(pszAccess, '+') == NULL, bMap, FALSE);
+}
+
+/* DBFOpenStream */
+/* Opens a DBF file for reading from a stream which can't seek, such */
+/* as a pipe.  The header is read once, and then the records can only */
+/* be read in order (records may be skipped, but not read again). */
+/* The handle is read-only, and DBFClose closes fp. */
+DBFHandle  DBFOpenStream(FILE *fp) {
+  return DBFOpenHandle(fp, NULL, TRUE, FALSE, TRUE);
+}
+
+/* DBFOpenHandle */
+/* Reads the header of an open DBF file, and sets up a handle for it. */
+/* pfCPG, if not NULL, is the open .cpg file, which is read and closed. */
+static DBFHandle DBFOpenHandle(FILE *fp, FILE *pfCPG, int bReadOnly, int bMap, int bStream) {
+  DBFHandle psDBF;
+  unsigned char *pabyBuf;
+  int nFields, nHeadLen, iField;
+  int nBufSize = 500;
+
+  pthread_once(&sKernelsOnce, DBFInitKernels);
+
+  psDBF = (DBFHandle) calloc(1, sizeof(DBFInfo));
+  psDBF->fp = fp;
   psDBF->bNoHeader = FALSE;
   psDBF->nCurrentRecord = -1;
   psDBF->bCurrentRecordModified = FALSE;
+  psDBF->bReadOnly = bReadOnly;
+  psDBF->bStream = bStream;
 
   /* Read Table Header info */
   pabyBuf = (unsigned char *) malloc(nBufSize);
@@ -214,7 +488,7 @@ DBFHandle  DBFOpen(const char *pszFilename, const char *pszAccess) {
 
   psDBF->nRecords =
     pabyBuf[4] + pabyBuf[5] * 256 + pabyBuf[6] * 256 * 256 +
-    pabyBuf[7] * 256 * 256 * 256;
+    pabyBuf[7] * (int64_t) 256 * 256 * 256;
 
   psDBF->nHeaderLength = nHeadLen = pabyBuf[8] + pabyBuf[9] * 256;
   psDBF->nRecordLength = pabyBuf[10] + pabyBuf[11] * 256;
@@ -253,11 +527,14 @@ DBFHandle  DBFOpen(const char *pszFilename, const char *pszAccess) {
   }
 
 
-  /* Read in Field Definitions */
+  /* Read in Field Definitions.  Whatever follows them in the header */
+  /* (the terminator, and any padding) is read too, so a stream is left */
+  /* at the first record. */
   pabyBuf = (unsigned char *) SfRealloc(pabyBuf, nHeadLen);
   psDBF->pszHeader = (char *) pabyBuf;
 
-  fseek(psDBF->fp, 32, 0);
+  if (!bStream)
+    fseek(psDBF->fp, 32, 0);
   if (fread(pabyBuf, nHeadLen - 32, 1, psDBF->fp) != 1) {
     fclose(psDBF->fp);
     free(pabyBuf);
@@ -274,7 +551,13 @@ DBFHandle  DBFOpen(const char *pszFilename, const char *pszAccess) {
   for (iField = 0; iField < nFields; iField++) {
     unsigned char *pabyFInfo;
 
+    /* The descriptors end at the terminator, which may be followed */
+    /* by padding up to the header length. */
     pabyFInfo = pabyBuf + iField * 32;
+    if (pabyFInfo[0] == 0x0d) {
+      psDBF->nFields = nFields = iField;
+      break;
+    }
     if (pabyFInfo[11] == 'N' || pabyFInfo[11] == 'F') {
       psDBF->panFieldSize[iField] = pabyFInfo[16];
       psDBF->panFieldDecimals[iField] = pabyFInfo[17];
@@ -291,6 +574,34 @@ DBFHandle  DBFOpen(const char *pszFilename, const char *pszAccess) {
         psDBF->panFieldSize[iField - 1];
   }
 
+  /* Map the whole file if asked to.  If the mapping can't be made */
+  /* (empty file, no address space) we quietly fall back to stdio. */
+  if (bMap && psDBF->bReadOnly) {
+    struct stat sStat;
+    if (fstat(fileno(psDBF->fp), &sStat) == 0 && sStat.st_size > 0
+        && (unsigned long long) sStat.st_size == (size_t) sStat.st_size) {
+      void *pMap = mmap(NULL, (size_t) sStat.st_size, PROT_READ, MAP_SHARED,
+                        fileno(psDBF->fp), 0);
+      if (pMap != MAP_FAILED) {
+        psDBF->pabyMap = (unsigned char *) pMap;
+        psDBF->nMapSize = (size_t) sStat.st_size;
+      }
+    }
+  }
+
+  /* Read-only handles have no private record buffer: records are */
+  /* views into the mapping or into a block of consecutive records. */
+  if (psDBF->bReadOnly) {
+    free(psDBF->pszCurrentRecord);
+    psDBF->pszCurrentRecord = NULL;
+    if (psDBF->pabyMap == NULL) {
+      psDBF->nBlockCapacity = DBF_BLOCK_SIZE / (psDBF->nRecordLength > 0 ? psDBF->nRecordLength : 1);
+      if (psDBF->nBlockCapacity < 1)
+        psDBF->nBlockCapacity = 1;
+      psDBF->pachBlock = (char *) malloc(psDBF->nBlockCapacity * psDBF->nRecordLength + 1);
+    }
+  }
+
   return (psDBF);
 }
 
@@ -309,7 +620,12 @@ void  DBFClose(DBFHandle psDBF) {
     free(psDBF->pachFieldType);
     free(psDBF->pszWorkField);
     free(psDBF->pszHeader);
-    free(psDBF->pszCurrentRecord);
+    if (psDBF->pabyMap != NULL)
+      munmap(psDBF->pabyMap, psDBF->nMapSize);
+    if (!psDBF->bReadOnly)
+      free(psDBF->pszCurrentRecord);
+    free(psDBF->pachBlock);
+    free(psDBF->pachAppendBlock);
     free(psDBF->pszCodePage);
     free(psDBF);
   }
@@ -328,6 +644,8 @@ DBFHandle  DBFCreateEx(const char *pszFilename, const char *pszCodePage) {
   int i, ldid = -1;
   char chZero = '\0';
 
+  pthread_once(&sKernelsOnce, DBFInitKernels);
+
   /* Compute the base (layer) name.  If there is any extension */
   /* on the passed in filename we will strip it off. */
   pszBasename = (char *) malloc(strlen(pszFilename) + 5);
@@ -427,13 +745,14 @@ int  DBFAddNativeFieldType(DBFHandle psDBF, const char *pszFieldName,
                            char chType, int nWidth, int nDecimals) {
   char *pszFInfo;
   int i;
+  int64_t iRecord;
   int nOldRecordLength, nOldHeaderLength;
   char *pszRecord;
   char chFieldFill;
-  unsigned long nRecordOffset;
+  off_t nRecordOffset;
 
   /* make sure that everything is written in .dbf */
-  if (!DBFFlushRecord(psDBF))
+  if (psDBF->bReadOnly || !DBFFlushRecord(psDBF))
     return -1;
 
   /* Do some checking to ensure we can add records to this file. */
@@ -442,6 +761,13 @@ int  DBFAddNativeFieldType(DBFHandle psDBF, const char *pszFieldName,
 
   if (nWidth > 255)
     nWidth = 255;
+
+  /* The header and record lengths are held in two bytes each. */
+  if (psDBF->nRecordLength + nWidth > 65535 || psDBF->nHeaderLength + 32 > 65535) {
+    fprintf(stderr, "Cannot add field %s. DBF record or header length limit (65535 bytes) reached.\n",
+            pszFieldName);
+    return -1;
+  }
   nOldRecordLength = psDBF->nRecordLength;
   nOldHeaderLength = psDBF->nHeaderLength;
 
@@ -490,13 +816,13 @@ int  DBFAddNativeFieldType(DBFHandle psDBF, const char *pszFieldName,
   pszRecord = (char *) malloc(sizeof(char) * psDBF->nRecordLength);
   chFieldFill = DBFGetNullCharacter(chType);
 
-  for (i = psDBF->nRecords - 1; i >= 0; --i) {
-    nRecordOffset = nOldRecordLength * (unsigned long) i + nOldHeaderLength;
-    fseek(psDBF->fp, nRecordOffset, 0);
+  for (iRecord = psDBF->nRecords - 1; iRecord >= 0; --iRecord) {
+    nRecordOffset = nOldRecordLength * (off_t) iRecord + nOldHeaderLength;
+    fseeko(psDBF->fp, nRecordOffset, 0);
     fread(pszRecord, nOldRecordLength, 1, psDBF->fp);
     memset(pszRecord + nOldRecordLength, chFieldFill, nWidth);
-    nRecordOffset = psDBF->nRecordLength * (unsigned long) i + psDBF->nHeaderLength;
-    fseek(psDBF->fp, nRecordOffset, 0);
+    nRecordOffset = psDBF->nRecordLength * (off_t) iRecord + psDBF->nHeaderLength;
+    fseeko(psDBF->fp, nRecordOffset, 0);
     fread(pszRecord, psDBF->nRecordLength, 1, psDBF->fp);
   }
 
@@ -509,11 +835,39 @@ int  DBFAddNativeFieldType(DBFHandle psDBF, const char *pszFieldName,
   return (psDBF->nFields - 1);
 }
 
+/* DBFTupleFieldView */
+/* Locates a field within a record, trimmed (if TRIM_DBF_WHITESPACE) */
+/* by narrowing the bounds rather than by moving any bytes. */
+static void DBFTupleFieldView(DBFHandle psDBF, const char *pachTuple, int iField,
+                              const char **ppachValue, int *pnLength) {
+  const char *pachValue = pachTuple + psDBF->panFieldOffset[iField];
+  const char *pachNUL;
+  int nLength = psDBF->panFieldSize[iField];
+
+  /* Like strncpy(), stop at an embedded NUL. */
+  pachNUL = (const char *) memchr(pachValue, '\0', nLength);
+  if (pachNUL != NULL)
+    nLength = pachNUL - pachValue;
+
+#ifdef TRIM_DBF_WHITESPACE
+  {
+    int nBlanks = DBFSpanBlanks(pachValue, nLength);
+    pachValue += nBlanks;
+    nLength -= nBlanks;
+    nLength -= DBFSpanTrailingBlanks(pachValue, nLength);
+  }
+#endif
+
+  *ppachValue = pachValue;
+  *pnLength = nLength;
+}
+
 /* DBFReadAttribute */
-static void *DBFReadAttribute(DBFHandle psDBF, int hEntity, int iField,
+static void *DBFReadAttribute(DBFHandle psDBF, int64_t hEntity, int iField,
                               char chReqType) {
   unsigned char *pabyRec;
-  void *pReturnField = NULL;
+  const char *pachValue;
+  int nLength;
 
   /* Verify selection. */
   if (hEntity < 0 || hEntity >= psDBF->nRecords)
@@ -535,69 +889,159 @@ static void *DBFReadAttribute(DBFHandle psDBF, int hEntity, int iField,
       psDBF->pszWorkField = (char *) realloc(psDBF->pszWorkField,psDBF->nWorkFieldLength);
   }
 
-  /* Extract the requested field. */
-  strncpy(psDBF->pszWorkField,
-          ((const char *) pabyRec) + psDBF->panFieldOffset[iField],
-          psDBF->panFieldSize[iField]);
-  psDBF->pszWorkField[psDBF->panFieldSize[iField]] = '\0';
+  /* Copy out just the (trimmed) value.  Numeric fields are decoded */
+  /* straight from the record by DBFDecodeNumber instead. */
+  DBFTupleFieldView(psDBF, (const char *) pabyRec, iField, &pachValue, &nLength);
+  memcpy(psDBF->pszWorkField, pachValue, nLength);
+  psDBF->pszWorkField[nLength] = '\0';
+  return psDBF->pszWorkField;
+}
+
+/* DBFGetFieldView64 */
+/* Points *ppachValue at a field of a record, with its length in */
+/* *pnLength.  The value is not NUL-terminated, and stays valid only */
+/* until another record is read through the handle. */
+int  DBFGetFieldView64(DBFHandle psDBF, int64_t iRecord, int iField,
+                     const char **ppachValue, int *pnLength) {
+  if (iRecord < 0 || iRecord >= psDBF->nRecords)
+    return FALSE;
+  if (iField < 0 || iField >= psDBF->nFields)
+    return FALSE;
+  if (!DBFLoadRecord(psDBF, iRecord))
+    return FALSE;
+  DBFTupleFieldView(psDBF, psDBF->pszCurrentRecord, iField, ppachValue, pnLength);
+  return TRUE;
+}
 
-  pReturnField = psDBF->pszWorkField;
+/* DBFGetTupleFieldView */
+/* As DBFGetFieldView, but on a record already in memory, such as one */
+/* returned by DBFReadTuple or a DBFScan function. */
+int  DBFGetTupleFieldView(DBFHandle psDBF, const char *pachTuple, int iField,
+                          const char **ppachValue, int *pnLength) {
+  if (pachTuple == NULL || iField < 0 || iField >= psDBF->nFields)
+    return FALSE;
+  DBFTupleFieldView(psDBF, pachTuple, iField, ppachValue, pnLength);
+  return TRUE;
+}
 
-  /* Decode the field. */
-  if (chReqType == 'N') {
-    psDBF->dfDoubleField = atof(psDBF->pszWorkField);
-    pReturnField = &(psDBF->dfDoubleField);
+/* Powers of ten that are exact as doubles. */
+static const double adfPowersOf10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* DBFDecodeNumber */
+/* Decodes the text of a numeric field in place.  Plain decimal */
+/* numbers (blanks, a sign, up to 19 digits and a decimal point) are */
+/* converted without atof(): integers exactly to *pnValue, and decimals */
+/* with one division of two exact doubles, which rounds just as */
+/* strtod() does.  Anything else (exponents, more digits, junk) goes */
+/* through atof() as before.  Returns TRUE if the value is an integer. */
+static int DBFDecodeNumber(const char *pachValue, int nLength,
+                           double *pdfValue, long long *pnValue) {
+  const char *pachEnd, *pach;
+  unsigned long long nMantissa = 0;
+  int nDigits = 0, nDecimals = -1, bNegative = FALSE;
+  char szField[256];
+
+  /* Like strncpy(), stop at an embedded NUL, then drop the blanks. */
+  pachEnd = (const char *) memchr(pachValue, '\0', nLength);
+  if (pachEnd == NULL)
+    pachEnd = pachValue + nLength;
+  pach = pachValue + DBFSpanBlanks(pachValue, pachEnd - pachValue);
+  pachEnd -= DBFSpanTrailingBlanks(pach, pachEnd - pach);
+
+  if (pach < pachEnd && (*pach == '-' || *pach == '+'))
+    bNegative = *pach++ == '-';
+  for (; pach < pachEnd; pach++) {
+    if (*pach >= '0' && *pach <= '9') {
+      if (nDigits++ == 19)
+        break;
+      nMantissa = nMantissa * 10 + (*pach - '0');
+      if (nDecimals >= 0)
+        nDecimals++;
+    } else if (*pach == '.' && nDecimals < 0) {
+      nDecimals = 0;
+    } else {
+      break;
+    }
   }
 
-  /* Should we trim white space off the string attribute value? */
-#ifdef TRIM_DBF_WHITESPACE
-  else {
-    char *pchSrc, *pchDst;
-
-    pchDst = pchSrc = psDBF->pszWorkField;
-    while (*pchSrc == ' ')
-      pchSrc++;
-    while (*pchSrc != '\0')
-      *(pchDst++) = *(pchSrc++);
-    *pchDst = '\0';
-    while (pchDst != psDBF->pszWorkField && *(--pchDst) == ' ')
-      *pchDst = '\0';
+  *pnValue = 0;
+  if (pach == pachEnd && nDigits > 0) {
+    if (nDecimals <= 0 && nMantissa <= (unsigned long long) LLONG_MAX) {
+      *pnValue = bNegative ? -(long long) nMantissa : (long long) nMantissa;
+      *pdfValue = bNegative ? -(double) nMantissa : (double) nMantissa;
+      return TRUE;
+    }
+    if (nDecimals > 0 && nMantissa <= (1ULL << 53)) {
+      *pdfValue = (double) nMantissa / adfPowersOf10[nDecimals];
+      if (bNegative)
+        *pdfValue = -*pdfValue;
+      return FALSE;
+    }
   }
-#endif
 
-  return (pReturnField);
+  if (nLength > (int) sizeof(szField) - 1)
+    nLength = sizeof(szField) - 1;
+  strncpy(szField, pachValue, nLength);
+  szField[nLength] = '\0';
+  *pdfValue = atof(szField);
+  return FALSE;
 }
 
-/* DBFReadIntAttribute */
-int  DBFReadIntegerAttribute(DBFHandle psDBF, int iRecord, int iField) {
-  double *pdValue = (double *) DBFReadAttribute(psDBF, iRecord, iField, 'N');
-  return pdValue == NULL?  0.0 : *pdValue;
+/* DBFReadIntegerAttribute64 */
+int  DBFReadIntegerAttribute64(DBFHandle psDBF, int64_t iRecord, int iField) {
+  return DBFReadTupleIntegerAttribute(psDBF, DBFReadTuple64(psDBF, iRecord), iField);
 }
 
-/* DBFReadDoubleAttribute */
-double  DBFReadDoubleAttribute(DBFHandle psDBF, int iRecord, int iField) {
-  double *pdValue = (double *) DBFReadAttribute(psDBF, iRecord, iField, 'N');
-  return pdValue == NULL?  0.0 : *pdValue;
+/* DBFReadDoubleAttribute64 */
+double  DBFReadDoubleAttribute64(DBFHandle psDBF, int64_t iRecord, int iField) {
+  return DBFReadTupleDoubleAttribute(psDBF, DBFReadTuple64(psDBF, iRecord), iField);
 }
 
-/* DBFReadStringAttribute */
-const char* DBFReadStringAttribute(DBFHandle psDBF, int iRecord, int iField) {
-  return ((const char *) DBFReadAttribute(psDBF, iRecord, iField, 'C'));
+/* DBFReadTupleDoubleAttribute */
+/* Decodes a numeric field of a record already in memory.  Unlike */
+/* DBFReadDoubleAttribute this touches no state in the handle, so */
+/* threads may share the handle. */
+double  DBFReadTupleDoubleAttribute(DBFHandle psDBF, const char *pachTuple, int iField) {
+  double dfValue;
+  long long nValue;
+
+  if (pachTuple == NULL || iField < 0 || iField >= psDBF->nFields)
+    return 0.0;
+  DBFDecodeNumber(pachTuple + psDBF->panFieldOffset[iField],
+                  psDBF->panFieldSize[iField], &dfValue, &nValue);
+  return dfValue;
 }
 
-/* DBFReadLogicalAttribute */
-const char* DBFReadLogicalAttribute(DBFHandle psDBF, int iRecord, int iField) {
-  return ((const char *) DBFReadAttribute(psDBF, iRecord, iField, 'L'));
+/* DBFReadTupleIntegerAttribute */
+int  DBFReadTupleIntegerAttribute(DBFHandle psDBF, const char *pachTuple, int iField) {
+  double dfValue;
+  long long nValue;
+
+  if (pachTuple == NULL || iField < 0 || iField >= psDBF->nFields)
+    return 0;
+  if (DBFDecodeNumber(pachTuple + psDBF->panFieldOffset[iField],
+                      psDBF->panFieldSize[iField], &dfValue, &nValue)
+      && nValue >= INT_MIN && nValue <= INT_MAX)
+    return (int) nValue;
+  return dfValue;
 }
 
+/* DBFReadStringAttribute64 */
+const char* DBFReadStringAttribute64(DBFHandle psDBF, int64_t iRecord, int iField) {
+  return ((const char *) DBFReadAttribute(psDBF, iRecord, iField, 'C'));
+}
 
-/* DBFIsValueNULL */
-static int DBFIsValueNULL(char chType, const char *pszValue) {
-  int i;
+/* DBFReadLogicalAttribute64 */
+const char* DBFReadLogicalAttribute64(DBFHandle psDBF, int64_t iRecord, int iField) {
+  return ((const char *) DBFReadAttribute(psDBF, iRecord, iField, 'L'));
+}
 
-  if (pszValue == NULL)
-    return TRUE;
 
+/* DBFIsViewNULL */
+static int DBFIsViewNULL(char chType, const char *pachValue, int nLength) {
   switch (chType) {
   case 'N':
   case 'F':
@@ -606,38 +1050,47 @@ static int DBFIsValueNULL(char chType, const char *pszValue) {
     ** though according to the spec I think it should be all
     ** asterisks.
     */
-    if (pszValue[0] == '*')
+    if (nLength > 0 && pachValue[0] == '*')
       return TRUE;
-    for (i = 0; pszValue[i] != '\0'; i++) {
-      if (pszValue[i] != ' ')
-        return FALSE;
-    }
-    return TRUE;
+    return DBFSpanBlanks(pachValue, nLength) == nLength;
 
   case 'D':
     /* NULL date fields have value "00000000" */
-    return strncmp(pszValue, "00000000", 8) == 0;
+    return nLength >= 8 && strncmp(pachValue, "00000000", 8) == 0;
 
   case 'L':
     /* NULL boolean fields have value "?" */
-    return pszValue[0] == '?';
+    return nLength > 0 && pachValue[0] == '?';
 
   default:
     /* empty string fields are considered NULL */
-    return strlen(pszValue) == 0;
+    return nLength == 0;
   }
 }
 
-/* DBFIsAttributeNULL */
-int  DBFIsAttributeNULL(DBFHandle psDBF, int iRecord, int iField) {
-  const char *pszValue;
+/* DBFIsValueNULL */
+static int DBFIsValueNULL(char chType, const char *pszValue) {
+  if (pszValue == NULL)
+    return TRUE;
+  return DBFIsViewNULL(chType, pszValue, strlen(pszValue));
+}
 
-  pszValue = DBFReadStringAttribute(psDBF, iRecord, iField);
+/* DBFIsAttributeNULL64 */
+int  DBFIsAttributeNULL64(DBFHandle psDBF, int64_t iRecord, int iField) {
+  const char *pachValue;
+  int nLength;
 
-  if (pszValue == NULL)
+  if (!DBFGetFieldView64(psDBF, iRecord, iField, &pachValue, &nLength))
     return TRUE;
 
-  return DBFIsValueNULL(psDBF->pachFieldType[iField], pszValue);
+  return DBFIsViewNULL(psDBF->pachFieldType[iField], pachValue, nLength);
+}
+
+/* DBFIsFieldViewNULL */
+int  DBFIsFieldViewNULL(DBFHandle psDBF, int iField, const char *pachValue, int nLength) {
+  if (pachValue == NULL || iField < 0 || iField >= psDBF->nFields)
+    return TRUE;
+  return DBFIsViewNULL(psDBF->pachFieldType[iField], pachValue, nLength);
 }
 
 /* DBFGetFieldCount */
@@ -645,11 +1098,16 @@ int  DBFGetFieldCount(DBFHandle psDBF) {
   return (psDBF->nFields);
 }
 
-/* DBFGetRecordCount */
-int  DBFGetRecordCount(DBFHandle psDBF) {
+/* DBFGetRecordCount64 */
+int64_t  DBFGetRecordCount64(DBFHandle psDBF) {
   return (psDBF->nRecords);
 }
 
+/* DBFGetRecordLength */
+int  DBFGetRecordLength(DBFHandle psDBF) {
+  return (psDBF->nRecordLength);
+}
+
 /* DBFGetFieldInfo */
 DBFFieldType  DBFGetFieldInfo(DBFHandle psDBF, int iField, char *pszFieldName,
                                          int *pnWidth, int *pnDecimals) {
@@ -683,14 +1141,16 @@ DBFFieldType  DBFGetFieldInfo(DBFHandle psDBF, int iField, char *pszFieldName,
 }
 
 
+static int DBFFormatAttribute(DBFHandle psDBF, unsigned char *pabyRec, int iField, void *pValue);
+
 /* DBFWriteAttribute */
-static int DBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField, void *pValue) {
-  int i, j, nRetResult = TRUE;
-  unsigned char *pabyRec;
-  char szSField[400], szFormat[20];
+static int DBFWriteAttribute(DBFHandle psDBF, int64_t hEntity, int iField, void *pValue) {
+  /* Read-only (and memory-mapped) handles can't be written. */
+  if (psDBF->bReadOnly)
+    return (FALSE);
 
   /* Is this a valid record? */
-  if (hEntity < 0 || hEntity > psDBF->nRecords)
+  if (hEntity < 0 || hEntity > psDBF->nRecords || hEntity >= DBF_MAX_RECORDS)
     return (FALSE);
   if (psDBF->bNoHeader)
     DBFWriteHeader(psDBF);
@@ -700,8 +1160,7 @@ static int DBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField, void *pVa
     if (!DBFFlushRecord(psDBF))
       return FALSE;
     psDBF->nRecords++;
-    for (i = 0; i < psDBF->nRecordLength; i++)
-      psDBF->pszCurrentRecord[i] = ' ';
+    memset(psDBF->pszCurrentRecord, ' ', psDBF->nRecordLength);
     psDBF->nCurrentRecord = hEntity;
   }
 
@@ -709,9 +1168,18 @@ static int DBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField, void *pVa
   /* we accessed? */
   if (!DBFLoadRecord(psDBF, hEntity))
     return FALSE;
-  pabyRec = (unsigned char *) psDBF->pszCurrentRecord;
   psDBF->bCurrentRecordModified = TRUE;
   psDBF->bUpdated = TRUE;
+  return DBFFormatAttribute(psDBF, (unsigned char *) psDBF->pszCurrentRecord, iField, pValue);
+}
+
+/* DBFFormatAttribute */
+/* Puts a value (a double for a numeric field, a string, a 'T' or 'F' */
+/* for a logical field, or NULL) in its field of a record buffer. */
+/* Returns FALSE if it had to be cut short to fit. */
+static int DBFFormatAttribute(DBFHandle psDBF, unsigned char *pabyRec, int iField, void *pValue) {
+  int j, nRetResult = TRUE;
+  char szSField[400], szFormat[20];
 
   /* Translate NULL value to valid DBF file representation. */
   if (pValue == NULL) {
@@ -773,13 +1241,17 @@ static int DBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField, void *pVa
   return (nRetResult);
 }
 
-/* DBFWriteAttributeDirectly */
-int  DBFWriteAttributeDirectly(DBFHandle psDBF, int hEntity, int iField,void *pValue) {
-  int i, j;
+/* DBFWriteAttributeDirectly64 */
+int  DBFWriteAttributeDirectly64(DBFHandle psDBF, int64_t hEntity, int iField,void *pValue) {
+  int j;
   unsigned char *pabyRec;
 
+  /* Read-only (and memory-mapped) handles can't be written. */
+  if (psDBF->bReadOnly)
+    return (FALSE);
+
   /* Is this a valid record? */
-  if (hEntity < 0 || hEntity > psDBF->nRecords)
+  if (hEntity < 0 || hEntity > psDBF->nRecords || hEntity >= DBF_MAX_RECORDS)
     return (FALSE);
 
   if (psDBF->bNoHeader)
@@ -791,8 +1263,7 @@ int  DBFWriteAttributeDirectly(DBFHandle psDBF, int hEntity, int iField,void *pV
       return FALSE;
 
     psDBF->nRecords++;
-    for (i = 0; i < psDBF->nRecordLength; i++)
-      psDBF->pszCurrentRecord[i] = ' ';
+    memset(psDBF->pszCurrentRecord, ' ', psDBF->nRecordLength);
     psDBF->nCurrentRecord = hEntity;
   }
 
@@ -816,40 +1287,43 @@ int  DBFWriteAttributeDirectly(DBFHandle psDBF, int hEntity, int iField,void *pV
   return (TRUE);
 }
 
-/* DBFWriteDoubleAttribute */
-int  DBFWriteDoubleAttribute(DBFHandle psDBF, int iRecord, int iField, double dValue) {
+/* DBFWriteDoubleAttribute64 */
+int  DBFWriteDoubleAttribute64(DBFHandle psDBF, int64_t iRecord, int iField, double dValue) {
   return (DBFWriteAttribute(psDBF, iRecord, iField, (void *) &dValue));
 }
 
-/* DBFWriteIntegerAttribute */
-int  DBFWriteIntegerAttribute(DBFHandle psDBF, int iRecord, int iField,int nValue) {
+/* DBFWriteIntegerAttribute64 */
+int  DBFWriteIntegerAttribute64(DBFHandle psDBF, int64_t iRecord, int iField,int nValue) {
   double dValue = nValue;
   return (DBFWriteAttribute(psDBF, iRecord, iField, (void *) &dValue));
 }
 
-/* DBFWriteStringAttribute */
-int  DBFWriteStringAttribute(DBFHandle psDBF, int iRecord, int iField, const char *pszValue) {
+/* DBFWriteStringAttribute64 */
+int  DBFWriteStringAttribute64(DBFHandle psDBF, int64_t iRecord, int iField, const char *pszValue) {
   return (DBFWriteAttribute(psDBF, iRecord, iField, (void *) pszValue));
 }
 
 
-/* DBFWriteNULLAttribute */
-int  DBFWriteNULLAttribute(DBFHandle psDBF, int iRecord, int iField) {
+/* DBFWriteNULLAttribute64 */
+int  DBFWriteNULLAttribute64(DBFHandle psDBF, int64_t iRecord, int iField) {
   return (DBFWriteAttribute(psDBF, iRecord, iField, NULL));
 }
 
-/* DBFWriteLogicalAttribute */
-int  DBFWriteLogicalAttribute(DBFHandle psDBF, int iRecord, int iField, const char lValue) {
+/* DBFWriteLogicalAttribute64 */
+int  DBFWriteLogicalAttribute64(DBFHandle psDBF, int64_t iRecord, int iField, const char lValue) {
   return (DBFWriteAttribute(psDBF, iRecord, iField, (void *) (&lValue)));
 }
 
-/* DBFWriteTuple */
-int  DBFWriteTuple(DBFHandle psDBF, int hEntity, void *pRawTuple) {
-  int i;
+/* DBFWriteTuple64 */
+int  DBFWriteTuple64(DBFHandle psDBF, int64_t hEntity, void *pRawTuple) {
   unsigned char *pabyRec;
 
+  /* Read-only (and memory-mapped) handles can't be written. */
+  if (psDBF->bReadOnly)
+    return (FALSE);
+
   /* Is this a valid record? */
-  if (hEntity < 0 || hEntity > psDBF->nRecords)
+  if (hEntity < 0 || hEntity > psDBF->nRecords || hEntity >= DBF_MAX_RECORDS)
     return (FALSE);
 
   if (psDBF->bNoHeader)
@@ -860,8 +1334,7 @@ int  DBFWriteTuple(DBFHandle psDBF, int hEntity, void *pRawTuple) {
     if (!DBFFlushRecord(psDBF))
       return FALSE;
     psDBF->nRecords++;
-    for (i = 0; i < psDBF->nRecordLength; i++)
-      psDBF->pszCurrentRecord[i] = ' ';
+    memset(psDBF->pszCurrentRecord, ' ', psDBF->nRecordLength);
     psDBF->nCurrentRecord = hEntity;
   }
 
@@ -876,8 +1349,8 @@ int  DBFWriteTuple(DBFHandle psDBF, int hEntity, void *pRawTuple) {
   return (TRUE);
 }
 
-/* DBFReadTuple */
-const char* DBFReadTuple(DBFHandle psDBF, int hEntity) {
+/* DBFReadTuple64 */
+const char* DBFReadTuple64(DBFHandle psDBF, int64_t hEntity) {
   if (hEntity < 0 || hEntity >= psDBF->nRecords)
     return (NULL);
 
@@ -887,6 +1360,309 @@ const char* DBFReadTuple(DBFHandle psDBF, int hEntity) {
   return (const char *) psDBF->pszCurrentRecord;
 }
 
+/* DBFReadRecordBlock64 */
+/* Reads up to nRecords consecutive records starting at iFirstRecord */
+/* into pachBuffer with a single read.  Returns the number of records */
+/* read, 0 at the end of the file, or -1 on error. */
+int DBFReadRecordBlock64(DBFHandle psDBF, int64_t iFirstRecord, int nRecords, char *pachBuffer) {
+  off_t nRecordOffset;
+  char szMessage[128];
+  int nRead;
+
+  if (iFirstRecord < 0 || iFirstRecord > psDBF->nRecords || nRecords < 0)
+    return -1;
+  if (nRecords > psDBF->nRecords - iFirstRecord)
+    nRecords = (int) (psDBF->nRecords - iFirstRecord);
+  if (nRecords == 0)
+    return 0;
+
+  nRecordOffset = psDBF->nRecordLength * (off_t) iFirstRecord + psDBF->nHeaderLength;
+  if (psDBF->pabyMap != NULL) {
+    if (nRecordOffset >= (off_t) psDBF->nMapSize)
+      nRead = 0;
+    else
+      nRead = (psDBF->nMapSize - nRecordOffset) / psDBF->nRecordLength;
+    if (nRead > nRecords)
+      nRead = nRecords;
+    memcpy(pachBuffer, psDBF->pabyMap + nRecordOffset,
+           (size_t) nRead * psDBF->nRecordLength);
+    DBFCountIO(&psDBF->sIOStats.nBytesRead, (int64_t) nRead * psDBF->nRecordLength);
+  } else if (psDBF->bStream) {
+    /* Streams only go forwards: records before the ones wanted are */
+    /* read and thrown away. */
+    if (iFirstRecord < psDBF->iStreamRecord) {
+      sprintf(szMessage, "Record %lld has already been read from the DBF stream.\n", (long long) iFirstRecord);
+      fprintf(stderr,szMessage);
+      return -1;
+    }
+    while (psDBF->iStreamRecord < iFirstRecord) {
+      int nSkip = nRecords;
+      if (nSkip > iFirstRecord - psDBF->iStreamRecord)
+        nSkip = (int) (iFirstRecord - psDBF->iStreamRecord);
+      nRead = fread(pachBuffer, psDBF->nRecordLength, nSkip, psDBF->fp);
+      DBFCountIO(&psDBF->sIOStats.nReads, 1);
+      DBFCountIO(&psDBF->sIOStats.nBytesRead, (int64_t) nRead * psDBF->nRecordLength);
+      psDBF->iStreamRecord += nRead;
+      if (nRead < nSkip)
+        break;
+    }
+    nRead = 0;
+    if (psDBF->iStreamRecord == iFirstRecord) {
+      nRead = fread(pachBuffer, psDBF->nRecordLength, nRecords, psDBF->fp);
+      DBFCountIO(&psDBF->sIOStats.nReads, 1);
+      DBFCountIO(&psDBF->sIOStats.nBytesRead, (int64_t) nRead * psDBF->nRecordLength);
+      psDBF->iStreamRecord += nRead;
+    }
+  } else if (psDBF->bReadOnly) {
+    /* pread() leaves the stream alone, so read-only handles can be */
+    /* read from several threads at once. */
+    size_t nWanted = (size_t) nRecords * psDBF->nRecordLength, nDone = 0;
+    while (nDone < nWanted) {
+      ssize_t n = pread(fileno(psDBF->fp), pachBuffer + nDone, nWanted - nDone,
+                        (off_t) (nRecordOffset + nDone));
+      DBFCountIO(&psDBF->sIOStats.nReads, 1);
+      if (n <= 0)
+        break;
+      nDone += n;
+    }
+    DBFCountIO(&psDBF->sIOStats.nBytesRead, nDone);
+    nRead = nDone / psDBF->nRecordLength;
+  } else {
+    if (!DBFFlushRecord(psDBF))
+      return -1;
+    DBFCountIO(&psDBF->sIOStats.nSeeks, 1);
+    if (fseeko(psDBF->fp, nRecordOffset, SEEK_SET) != 0) {
+      sprintf(szMessage, "fseeko(%lld) failed on DBF file.\n",(long long) nRecordOffset);
+      fprintf(stderr,szMessage);
+      return -1;
+    }
+    nRead = fread(pachBuffer, psDBF->nRecordLength, nRecords, psDBF->fp);
+    DBFCountIO(&psDBF->sIOStats.nReads, 1);
+    DBFCountIO(&psDBF->sIOStats.nBytesRead, (int64_t) nRead * psDBF->nRecordLength);
+  }
+  if (nRead == 0) {
+    sprintf(szMessage, "fread(%d) failed on DBF file.\n",psDBF->nRecordLength);
+    fprintf(stderr,szMessage);
+    return -1;
+  }
+  return nRead;
+}
+
+/* DBFReadAheadThread */
+/* Reads the blocks of a scan, staying at most DBF_READ_AHEAD - 1 */
+/* blocks ahead of the one the caller has.  Stops after a short or */
+/* failed read, which it records as a failure of the scan. */
+static void *DBFReadAheadThread(void *pArg) {
+  DBFScanHandle psScan = (DBFScanHandle) pArg;
+  DBFReadAheadInfo *psAhead = psScan->psAhead;
+  int64_t k, iFirst;
+  int nRecords, nRead, bStop;
+
+  for (k = 0; k < psAhead->nBlocks; k++) {
+    pthread_mutex_lock(&psAhead->sLock);
+    while (!psAhead->bStop && k >= psAhead->nTaken + DBF_READ_AHEAD - 1)
+      pthread_cond_wait(&psAhead->sCond, &psAhead->sLock);
+    bStop = psAhead->bStop;
+    pthread_mutex_unlock(&psAhead->sLock);
+    if (bStop)
+      break;
+
+    iFirst = psAhead->iFirstRecord + k * psScan->nBlockCapacity;
+    nRecords = psScan->nBlockCapacity;
+    if (nRecords > psScan->iEndRecord - iFirst)
+      nRecords = (int) (psScan->iEndRecord - iFirst);
+    nRead = DBFReadRecordBlock64(psScan->hDBF, iFirst, nRecords,
+                               psAhead->apachBuffer[k % DBF_READ_AHEAD]);
+
+    pthread_mutex_lock(&psAhead->sLock);
+    psAhead->anRecords[k % DBF_READ_AHEAD] = nRead;
+    psAhead->nRead = k + 1;
+    if (nRead < nRecords)
+      psAhead->bFailed = TRUE;
+    pthread_cond_broadcast(&psAhead->sCond);
+    pthread_mutex_unlock(&psAhead->sLock);
+    if (nRead < nRecords)
+      break;
+  }
+
+  pthread_mutex_lock(&psAhead->sLock);
+  psAhead->bFinished = TRUE;
+  pthread_cond_broadcast(&psAhead->sCond);
+  pthread_mutex_unlock(&psAhead->sLock);
+  return NULL;
+}
+
+/* DBFScanOpen64 */
+/* Starts a sequential scan of nRecords records from iFirstRecord (all */
+/* the remaining records if nRecords is negative), read nBlockSize bytes */
+/* at a time (DBF_BLOCK_SIZE if nBlockSize is 0).  Mapped files are */
+/* scanned in place without copying.  Scans of more than one block of */
+/* other read-only handles read ahead on a thread of their own. */
+DBFScanHandle DBFScanOpen64(DBFHandle psDBF, int64_t iFirstRecord, int64_t nRecords, int nBlockSize) {
+  DBFScanHandle psScan;
+
+  if (iFirstRecord < 0 || iFirstRecord > psDBF->nRecords)
+    return NULL;
+  if (nRecords < 0 || nRecords > psDBF->nRecords - iFirstRecord)
+    nRecords = psDBF->nRecords - iFirstRecord;
+  if (nBlockSize <= 0)
+    nBlockSize = DBF_BLOCK_SIZE;
+
+  psScan = (DBFScanHandle) calloc(1, sizeof(DBFScanInfo));
+  psScan->hDBF = psDBF;
+  psScan->iNextRecord = iFirstRecord;
+  psScan->iEndRecord = iFirstRecord + nRecords;
+  psScan->nBlockCapacity = nBlockSize / (psDBF->nRecordLength > 0 ? psDBF->nRecordLength : 1);
+  if (psScan->nBlockCapacity < 1)
+    psScan->nBlockCapacity = 1;
+  if (psDBF->pabyMap == NULL && psDBF->bReadOnly && nRecords > psScan->nBlockCapacity) {
+    DBFReadAheadInfo *psAhead = (DBFReadAheadInfo *) calloc(1, sizeof(DBFReadAheadInfo));
+    int i;
+    for (i = 0; i < DBF_READ_AHEAD; i++)
+      psAhead->apachBuffer[i] = (char *) malloc(psScan->nBlockCapacity * psDBF->nRecordLength + 1);
+    psAhead->iFirstRecord = iFirstRecord;
+    psAhead->nBlocks = (nRecords + psScan->nBlockCapacity - 1) / psScan->nBlockCapacity;
+    pthread_mutex_init(&psAhead->sLock, NULL);
+    pthread_cond_init(&psAhead->sCond, NULL);
+    psScan->psAhead = psAhead;
+    if (pthread_create(&psAhead->hThread, NULL, DBFReadAheadThread, psScan) != 0) {
+      psScan->psAhead = NULL;
+      for (i = 0; i < DBF_READ_AHEAD; i++)
+        free(psAhead->apachBuffer[i]);
+      free(psAhead);
+    }
+  }
+  if (psDBF->pabyMap == NULL && psScan->psAhead == NULL)
+    psScan->pachBuffer = (char *) malloc(psScan->nBlockCapacity * psDBF->nRecordLength + 1);
+  return psScan;
+}
+
+/* DBFAdviseWillNeed */
+/* Tells the kernel that a range of a mapped file will be read soon, */
+/* so that it is paged in while the caller works on the current block. */
+static void DBFAdviseWillNeed(DBFHandle psDBF, size_t nOffset, size_t nLength) {
+  size_t nPage = (size_t) sysconf(_SC_PAGESIZE);
+  size_t nStart = nOffset / nPage * nPage;
+
+  if (nOffset >= psDBF->nMapSize)
+    return;
+  if (nOffset + nLength > psDBF->nMapSize)
+    nLength = psDBF->nMapSize - nOffset;
+  madvise(psDBF->pabyMap + nStart, nLength + (nOffset - nStart), MADV_WILLNEED);
+}
+
+/* DBFScanNextBlock64 */
+/* Returns the next block of consecutive records, setting the index of */
+/* its first record and the number of records in it, or NULL at the */
+/* end of the scan or on a read error (which DBFScanFailed tells). A */
+/* block may be short if the file ends before the records it should */
+/* have; the next call then fails. */
+const char* DBFScanNextBlock64(DBFScanHandle psScan, int64_t *piFirstRecord, int *pnRecords) {
+  DBFHandle psDBF = psScan->hDBF;
+  int nRecords = psScan->nBlockCapacity;
+
+  if (nRecords > psScan->iEndRecord - psScan->iNextRecord)
+    nRecords = (int) (psScan->iEndRecord - psScan->iNextRecord);
+  if (nRecords <= 0)
+    return NULL;
+
+  if (psDBF->pabyMap != NULL) {
+    off_t nRecordOffset = psDBF->nRecordLength * (off_t) psScan->iNextRecord
+      + psDBF->nHeaderLength;
+    off_t nFit = 0;
+    if (nRecordOffset < (off_t) psDBF->nMapSize)
+      nFit = ((off_t) psDBF->nMapSize - nRecordOffset) / psDBF->nRecordLength;
+    if (nFit < nRecords)
+      nRecords = (int) nFit;
+    if (nRecords == 0) {
+      fprintf(stderr, "Record %lld is beyond the end of the DBF file.\n", (long long) psScan->iNextRecord);
+      psScan->bFailed = TRUE;
+      return NULL;
+    }
+    psScan->pachBlock = (const char *) psDBF->pabyMap + nRecordOffset;
+    DBFCountIO(&psDBF->sIOStats.nBytesRead, (int64_t) nRecords * psDBF->nRecordLength);
+    DBFAdviseWillNeed(psDBF, nRecordOffset + nRecords * (size_t) psDBF->nRecordLength,
+                      nRecords * (size_t) psDBF->nRecordLength);
+  } else if (psScan->psAhead != NULL) {
+    /* Hand back the caller's last block, and wait for the next. */
+    DBFReadAheadInfo *psAhead = psScan->psAhead;
+    int64_t k = psAhead->nTaken;
+    pthread_mutex_lock(&psAhead->sLock);
+    psAhead->nTaken = k + 1;
+    pthread_cond_broadcast(&psAhead->sCond);
+    while (psAhead->nRead <= k && !psAhead->bFinished)
+      pthread_cond_wait(&psAhead->sCond, &psAhead->sLock);
+    nRecords = psAhead->nRead > k ? psAhead->anRecords[k % DBF_READ_AHEAD] : 0;
+    if (psAhead->bFailed)
+      psScan->bFailed = TRUE;
+    pthread_mutex_unlock(&psAhead->sLock);
+    if (nRecords <= 0) {
+      psScan->bFailed = TRUE;
+      return NULL;
+    }
+    psScan->pachBlock = psAhead->apachBuffer[k % DBF_READ_AHEAD];
+  } else {
+    nRecords = DBFReadRecordBlock64(psDBF, psScan->iNextRecord, nRecords, psScan->pachBuffer);
+    if (nRecords <= 0) {
+      psScan->bFailed = TRUE;
+      return NULL;
+    }
+    psScan->pachBlock = psScan->pachBuffer;
+  }
+
+  psScan->iBlockFirst = psScan->iNextRecord;
+  psScan->nBlockRecords = nRecords;
+  psScan->iBlockPos = nRecords;
+  psScan->iNextRecord += nRecords;
+  if (piFirstRecord != NULL)
+    *piFirstRecord = psScan->iBlockFirst;
+  if (pnRecords != NULL)
+    *pnRecords = nRecords;
+  return psScan->pachBlock;
+}
+
+/* DBFScanNextRecord64 */
+/* Returns the next record of the scan, or NULL at the end. */
+const char* DBFScanNextRecord64(DBFScanHandle psScan, int64_t *piRecord) {
+  if (psScan->iBlockPos >= psScan->nBlockRecords) {
+    if (DBFScanNextBlock64(psScan, NULL, NULL) == NULL)
+      return NULL;
+    psScan->iBlockPos = 0;
+  }
+  if (piRecord != NULL)
+    *piRecord = psScan->iBlockFirst + psScan->iBlockPos;
+  return psScan->pachBlock + psScan->iBlockPos++ * psScan->hDBF->nRecordLength;
+}
+
+/* DBFScanFailed */
+/* Tells whether a scan stopped short of its records, on a read error */
+/* or at the end of a truncated file, rather than at its end. */
+int DBFScanFailed(DBFScanHandle psScan) {
+  return psScan == NULL || psScan->bFailed;
+}
+
+/* DBFScanClose */
+void DBFScanClose(DBFScanHandle psScan) {
+  if (psScan != NULL) {
+    DBFReadAheadInfo *psAhead = psScan->psAhead;
+    if (psAhead != NULL) {
+      int i;
+      pthread_mutex_lock(&psAhead->sLock);
+      psAhead->bStop = TRUE;
+      pthread_cond_broadcast(&psAhead->sCond);
+      pthread_mutex_unlock(&psAhead->sLock);
+      pthread_join(psAhead->hThread, NULL);
+      pthread_mutex_destroy(&psAhead->sLock);
+      pthread_cond_destroy(&psAhead->sCond);
+      for (i = 0; i < DBF_READ_AHEAD; i++)
+        free(psAhead->apachBuffer[i]);
+      free(psAhead);
+    }
+    free(psScan->pachBuffer);
+    free(psScan);
+  }
+}
+
 /* DBFCloneEmpty */
 DBFHandle  DBFCloneEmpty(DBFHandle psDBF, const char *pszFilename) {
   DBFHandle newDBF;
@@ -951,25 +1727,235 @@ int  DBFGetFieldIndex(DBFHandle psDBF, const char *pszFieldName) {
   return (-1);
 }
 
-/* DBFIsRecordDeleted */
-int  DBFIsRecordDeleted(DBFHandle psDBF, int iShape) {
+/* DBFFindField */
+/* Finds a field by name, or else by (0-based) number. Returns -1 if */
+/* there's no such field. */
+int  DBFFindField(DBFHandle psDBF, const char *pszField) {
+  int iField = DBFGetFieldIndex(psDBF, pszField);
+  long nField;
+  char *pszEnd;
+
+  if (iField < 0 && isdigit((unsigned char) pszField[0])) {
+    errno = 0;
+    nField = strtol(pszField, &pszEnd, 10);
+    if (*pszEnd == '\0' && errno != ERANGE
+        && nField >= 0 && nField < DBFGetFieldCount(psDBF))
+      iField = (int) nField;
+  }
+  return iField;
+}
+
+/* DBFIsRecordDeleted64 */
+/* The deleted flag is the first byte of the record, so unless the */
+/* record is already in memory, only that byte is read. */
+int  DBFIsRecordDeleted64(DBFHandle psDBF, int64_t iShape) {
+  off_t nRecordOffset;
+  char chFlag;
+
   /* Verify selection. */
   if (iShape < 0 || iShape >= psDBF->nRecords)
     return TRUE;
 
-  /* Have we read the record? */
-  if (!DBFLoadRecord(psDBF, iShape))
-    return FALSE;
+  nRecordOffset = psDBF->nRecordLength * (off_t) iShape + psDBF->nHeaderLength;
+  if (iShape == psDBF->nCurrentRecord && psDBF->pszCurrentRecord != NULL) {
+    chFlag = psDBF->pszCurrentRecord[0];
+  } else if (psDBF->pabyMap != NULL) {
+    if (nRecordOffset >= (off_t) psDBF->nMapSize)
+      return FALSE;
+    chFlag = (char) psDBF->pabyMap[nRecordOffset];
+    DBFCountIO(&psDBF->sIOStats.nBytesRead, 1);
+  } else if (psDBF->bReadOnly && iShape >= psDBF->nBlockFirst
+             && iShape < psDBF->nBlockFirst + psDBF->nBlockRecords) {
+    chFlag = psDBF->pachBlock[(iShape - psDBF->nBlockFirst) * psDBF->nRecordLength];
+  } else if (psDBF->bStream) {
+    if (!DBFLoadRecord(psDBF, iShape))
+      return FALSE;
+    chFlag = psDBF->pszCurrentRecord[0];
+  } else if (psDBF->bReadOnly) {
+    DBFCountIO(&psDBF->sIOStats.nReads, 1);
+    if (pread(fileno(psDBF->fp), &chFlag, 1, nRecordOffset) != 1)
+      return FALSE;
+    DBFCountIO(&psDBF->sIOStats.nBytesRead, 1);
+  } else {
+    if (!DBFFlushAppends(psDBF))
+      return FALSE;
+    DBFCountIO(&psDBF->sIOStats.nSeeks, 1);
+    DBFCountIO(&psDBF->sIOStats.nReads, 1);
+    if (fseeko(psDBF->fp, nRecordOffset, SEEK_SET) != 0
+        || fread(&chFlag, 1, 1, psDBF->fp) != 1)
+      return FALSE;
+    DBFCountIO(&psDBF->sIOStats.nBytesRead, 1);
+  }
 
   /* '*' means deleted. */
-  return psDBF->pszCurrentRecord[0] == '*';
+  return chFlag == '*';
 }
 
-/* DBFMarkRecordDeleted */
-int  DBFMarkRecordDeleted(DBFHandle psDBF, int iShape, int bIsDeleted) {
+/* DBFIsTupleDeleted */
+/* As DBFIsRecordDeleted, but on a record already in memory. */
+int  DBFIsTupleDeleted(DBFHandle psDBF, const char *pachTuple) {
+  (void) psDBF;
+  return pachTuple != NULL && pachTuple[0] == '*';
+}
+
+/* DBFAppendRecordBlock */
+/* Appends nRecords records, laid out one after another as they are in */
+/* the file, to the end of the file with a single write. */
+int  DBFAppendRecordBlock(DBFHandle psDBF, const char *pachRecords, int nRecords) {
+  off_t nRecordOffset;
+
+  if (psDBF->bReadOnly || nRecords < 0 || psDBF->nRecords + nRecords > DBF_MAX_RECORDS)
+    return FALSE;
+  if (psDBF->bNoHeader)
+    DBFWriteHeader(psDBF);
+  if (!DBFFlushRecord(psDBF))
+    return FALSE;
+
+  nRecordOffset = psDBF->nRecordLength * (off_t) psDBF->nRecords + psDBF->nHeaderLength;
+  DBFCountIO(&psDBF->sIOStats.nSeeks, 1);
+  DBFCountIO(&psDBF->sIOStats.nWrites, 1);
+  if (fseeko(psDBF->fp, nRecordOffset, SEEK_SET) != 0
+      || fwrite(pachRecords, psDBF->nRecordLength, nRecords, psDBF->fp) != (size_t) nRecords) {
+    fprintf(stderr, "Failure writing DBF records %lld to %lld.\n",
+            (long long) psDBF->nRecords, (long long) psDBF->nRecords + nRecords - 1);
+    return FALSE;
+  }
+  DBFCountIO(&psDBF->sIOStats.nBytesWritten, (int64_t) nRecords * psDBF->nRecordLength);
+  psDBF->nRecords += nRecords;
+  psDBF->bUpdated = TRUE;
+  return TRUE;
+}
+
+/* DBFWriteRecordBlock64 */
+/* Writes nRecords records, laid out one after another as they are in */
+/* the file, as records iFirstRecord on, with a single pwrite() at */
+/* their place in the file. Unlike the other writes, this doesn't go */
+/* through the handle's file position or current record, so several */
+/* threads can write blocks of a handle at once, in any order; the */
+/* record count becomes the greatest written. The fields must all be */
+/* added and the header written (as by DBFUpdateHeader) first, and the */
+/* header is brought up to date with the new count by DBFUpdateHeader */
+/* or DBFClose after. Any records gathered by DBFAppendTuple are */
+/* written first, since they are placed by the record count, which the */
+/* block may raise; a thread mixing the two must be the only writer. */
+int  DBFWriteRecordBlock64(DBFHandle psDBF, int64_t iFirstRecord, const char *pachRecords, int nRecords) {
+  off_t   nRecordOffset;
+  size_t  nBytes, nDone = 0;
+  ssize_t nWritten;
+  int64_t nCount, nEnd = iFirstRecord + nRecords;
+
+  if (psDBF->bReadOnly || psDBF->bNoHeader || iFirstRecord < 0 || nRecords < 0
+      || nEnd > DBF_MAX_RECORDS)
+    return FALSE;
+  if (!DBFFlushAppends(psDBF))
+    return FALSE;
+
+  nRecordOffset = psDBF->nRecordLength * (off_t) iFirstRecord + psDBF->nHeaderLength;
+  nBytes = (size_t) nRecords * psDBF->nRecordLength;
+  while (nDone < nBytes) {
+    DBFCountIO(&psDBF->sIOStats.nWrites, 1);
+    nWritten = pwrite(fileno(psDBF->fp), pachRecords + nDone, nBytes - nDone,
+                      nRecordOffset + nDone);
+    if (nWritten <= 0) {
+      fprintf(stderr, "Failure writing DBF records %lld to %lld.\n",
+              (long long) iFirstRecord, (long long) nEnd - 1);
+      return FALSE;
+    }
+    nDone += nWritten;
+  }
+  DBFCountIO(&psDBF->sIOStats.nBytesWritten, nBytes);
+
+  /* Raise the record count, unless another thread has raised it past */
+  /* these records already. */
+  nCount = __atomic_load_n(&psDBF->nRecords, __ATOMIC_RELAXED);
+  while (nCount < nEnd
+         && !__atomic_compare_exchange_n(&psDBF->nRecords, &nCount, nEnd, 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  __atomic_store_n(&psDBF->bUpdated, TRUE, __ATOMIC_RELAXED);
+  return TRUE;
+}
+
+/* DBFBlankTuple */
+/* Blank-fills a record buffer of DBFGetRecordLength bytes, to build a */
+/* new record in with the DBFSetTuple functions, and append it with */
+/* DBFAppendTuple. Building records this way doesn't touch the handle, */
+/* so several threads can build records at once. */
+void  DBFBlankTuple(DBFHandle psDBF, char *pachTuple) {
+  memset(pachTuple, ' ', psDBF->nRecordLength);
+}
+
+/* DBFSetTupleIntegerAttribute */
+int  DBFSetTupleIntegerAttribute(DBFHandle psDBF, char *pachTuple, int iField, int nValue) {
+  double dValue = nValue;
+  return DBFFormatAttribute(psDBF, (unsigned char *) pachTuple, iField, (void *) &dValue);
+}
+
+/* DBFSetTupleDoubleAttribute */
+int  DBFSetTupleDoubleAttribute(DBFHandle psDBF, char *pachTuple, int iField, double dValue) {
+  return DBFFormatAttribute(psDBF, (unsigned char *) pachTuple, iField, (void *) &dValue);
+}
+
+/* DBFSetTupleStringAttribute */
+int  DBFSetTupleStringAttribute(DBFHandle psDBF, char *pachTuple, int iField, const char *pszValue) {
+  return DBFFormatAttribute(psDBF, (unsigned char *) pachTuple, iField, (void *) pszValue);
+}
+
+/* DBFSetTupleNULLAttribute */
+int  DBFSetTupleNULLAttribute(DBFHandle psDBF, char *pachTuple, int iField) {
+  return DBFFormatAttribute(psDBF, (unsigned char *) pachTuple, iField, NULL);
+}
+
+/* DBFSetTupleLogicalAttribute */
+int  DBFSetTupleLogicalAttribute(DBFHandle psDBF, char *pachTuple, int iField, const char lValue) {
+  return DBFFormatAttribute(psDBF, (unsigned char *) pachTuple, iField, (void *) &lValue);
+}
+
+/* DBFAppendTuple */
+/* Appends a record to the end of the file. It is counted at once, */
+/* but the records are gathered in a buffer of the handle, and written */
+/* DBF_BLOCK_SIZE bytes at a time, or before the handle next reads or */
+/* writes a record, so they take a few large writes. The record count */
+/* in the header is only updated by DBFClose (or DBFUpdateHeader). */
+int  DBFAppendTuple(DBFHandle psDBF, const char *pachTuple) {
+  size_t nLength = psDBF->nRecordLength;
+
+  if (psDBF->bReadOnly || psDBF->nRecords >= DBF_MAX_RECORDS)
+    return FALSE;
+  if (psDBF->bNoHeader)
+    DBFWriteHeader(psDBF);
+  if ((psDBF->nAppendRecords + 1) * nLength > psDBF->nAppendBlockSize) {
+    if (!DBFFlushAppends(psDBF))
+      return FALSE;
+    if (nLength > psDBF->nAppendBlockSize) {
+      psDBF->nAppendBlockSize = nLength > DBF_BLOCK_SIZE ? nLength : DBF_BLOCK_SIZE;
+      psDBF->pachAppendBlock = (char *) SfRealloc(psDBF->pachAppendBlock, psDBF->nAppendBlockSize);
+    }
+  }
+  memcpy(psDBF->pachAppendBlock + psDBF->nAppendRecords * nLength, pachTuple, nLength);
+  psDBF->nAppendRecords++;
+  psDBF->nRecords++;
+  return TRUE;
+}
+
+/* DBFGetIOStats */
+/* Gets the counts of the calls made to read, write and seek records, */
+/* and of the bytes they moved, since the file was opened. */
+void  DBFGetIOStats(DBFHandle psDBF, DBFIOStats *psStats) {
+  psStats->nReads = __atomic_load_n(&psDBF->sIOStats.nReads, __ATOMIC_RELAXED);
+  psStats->nWrites = __atomic_load_n(&psDBF->sIOStats.nWrites, __ATOMIC_RELAXED);
+  psStats->nSeeks = __atomic_load_n(&psDBF->sIOStats.nSeeks, __ATOMIC_RELAXED);
+  psStats->nBytesRead = __atomic_load_n(&psDBF->sIOStats.nBytesRead, __ATOMIC_RELAXED);
+  psStats->nBytesWritten = __atomic_load_n(&psDBF->sIOStats.nBytesWritten, __ATOMIC_RELAXED);
+}
+
+/* DBFMarkRecordDeleted64 */
+int  DBFMarkRecordDeleted64(DBFHandle psDBF, int64_t iShape, int bIsDeleted) {
   char chNewFlag;
 
   /* Verify selection. */
+  if (psDBF->bReadOnly)
+    return FALSE;
   if (iShape < 0 || iShape >= psDBF->nRecords)
     return FALSE;
 
@@ -1004,15 +1990,16 @@ const char* DBFGetCodePage(DBFHandle psDBF) {
 int  DBFDeleteField(DBFHandle psDBF, int iField) {
   int nOldRecordLength, nOldHeaderLength;
   int nDeletedFieldOffset, nDeletedFieldSize;
-  unsigned long nRecordOffset;
+  off_t nRecordOffset;
   char *pszRecord;
-  int i, iRecord;
+  int i;
+  int64_t iRecord;
 
   if (iField < 0 || iField >= psDBF->nFields)
     return FALSE;
 
   /* make sure that everything is written in .dbf */
-  if (!DBFFlushRecord(psDBF))
+  if (psDBF->bReadOnly || !DBFFlushRecord(psDBF))
     return FALSE;
 
   /* get information about field to be deleted */
@@ -1059,13 +2046,13 @@ int  DBFDeleteField(DBFHandle psDBF, int iField) {
   pszRecord = (char *) malloc(sizeof(char) * nOldRecordLength);
   for (iRecord = 0; iRecord < psDBF->nRecords; iRecord++) {
     /* load record */
-    nRecordOffset = nOldRecordLength * (unsigned long) iRecord + nOldHeaderLength;
-    fseek(psDBF->fp, nRecordOffset, 0);
+    nRecordOffset = nOldRecordLength * (off_t) iRecord + nOldHeaderLength;
+    fseeko(psDBF->fp, nRecordOffset, 0);
     fread(pszRecord, nOldRecordLength, 1, psDBF->fp);
 
     /* move record in two steps */
-    nRecordOffset = psDBF->nRecordLength * (unsigned long) iRecord + psDBF->nHeaderLength;
-    fseek(psDBF->fp, nRecordOffset, 0);
+    nRecordOffset = psDBF->nRecordLength * (off_t) iRecord + psDBF->nHeaderLength;
+    fseeko(psDBF->fp, nRecordOffset, 0);
     fwrite(pszRecord, nDeletedFieldOffset, 1, psDBF->fp);
     fwrite(pszRecord + nDeletedFieldOffset +  nDeletedFieldSize,
            nOldRecordLength - nDeletedFieldOffset -
@@ -1081,8 +2068,9 @@ int  DBFDeleteField(DBFHandle psDBF, int iField) {
 
 /* DBFReorderFields */
 int  DBFReorderFields(DBFHandle psDBF, int *panMap) {
-  unsigned long nRecordOffset;
-  int i, iRecord;
+  off_t nRecordOffset;
+  int i;
+  int64_t iRecord;
   int *panFieldOffsetNew;
   int *panFieldSizeNew;
   int *panFieldDecimalsNew;
@@ -1095,7 +2083,7 @@ int  DBFReorderFields(DBFHandle psDBF, int *panMap) {
     return TRUE;
 
   /* make sure that everything is written in .dbf */
-  if (!DBFFlushRecord(psDBF))
+  if (psDBF->bReadOnly || !DBFFlushRecord(psDBF))
     return FALSE;
 
   panFieldOffsetNew = (int *) malloc(sizeof(int) * psDBF->nFields);
@@ -1129,10 +2117,10 @@ int  DBFReorderFields(DBFHandle psDBF, int *panMap) {
 
     /* shuffle fields in records */
     for (iRecord = 0; iRecord < psDBF->nRecords; iRecord++) {
-      nRecordOffset = psDBF->nRecordLength * (unsigned long) iRecord + psDBF->nHeaderLength;
+      nRecordOffset = psDBF->nRecordLength * (off_t) iRecord + psDBF->nHeaderLength;
 
       /* load record */
-      fseek(psDBF->fp, nRecordOffset, 0);
+      fseeko(psDBF->fp, nRecordOffset, 0);
       fread(pszRecord, psDBF->nRecordLength, 1,psDBF->fp);
       pszRecordNew[0] = pszRecord[0];
       for (i = 0; i < psDBF->nFields; i++) {
@@ -1141,7 +2129,7 @@ int  DBFReorderFields(DBFHandle psDBF, int *panMap) {
       }
 
       /* write record */
-      fseek(psDBF->fp, nRecordOffset, 0);
+      fseeko(psDBF->fp, nRecordOffset, 0);
       fwrite(pszRecordNew, psDBF->nRecordLength, 1, psDBF->fp);
     }
 
@@ -1168,11 +2156,11 @@ int  DBFReorderFields(DBFHandle psDBF, int *panMap) {
 int DBFAlterFieldDefn(DBFHandle psDBF, int iField, const char *pszFieldName,
                   char chType, int nWidth, int nDecimals) {
   int i;
-  int iRecord;
+  int64_t iRecord;
   int nOffset;
   int nOldWidth;
   int nOldRecordLength;
-  int nRecordOffset;
+  off_t nRecordOffset;
   char *pszFInfo;
   char chOldType;
   int bIsNULL;
@@ -1182,7 +2170,7 @@ int DBFAlterFieldDefn(DBFHandle psDBF, int iField, const char *pszFieldName,
     return FALSE;
 
   /* make sure that everything is written in .dbf */
-  if (!DBFFlushRecord(psDBF))
+  if (psDBF->bReadOnly || !DBFFlushRecord(psDBF))
     return FALSE;
 
   chFieldFill = DBFGetNullCharacter(chType);
@@ -1246,8 +2234,8 @@ int DBFAlterFieldDefn(DBFHandle psDBF, int iField, const char *pszFieldName,
     for (iRecord = 0; iRecord < psDBF->nRecords; iRecord++) {
 
       /* load record */
-      nRecordOffset = nOldRecordLength * (unsigned long) iRecord + psDBF->nHeaderLength;
-      fseek(psDBF->fp, nRecordOffset, 0);
+      nRecordOffset = nOldRecordLength * (off_t) iRecord + psDBF->nHeaderLength;
+      fseeko(psDBF->fp, nRecordOffset, 0);
       fread(pszRecord, nOldRecordLength, 1, psDBF->fp);
       memcpy(pszOldField, pszRecord + nOffset, nOldWidth);
       bIsNULL = DBFIsValueNULL(chOldType, pszOldField);
@@ -1269,8 +2257,8 @@ int DBFAlterFieldDefn(DBFHandle psDBF, int iField, const char *pszFieldName,
         memset(pszRecord + nOffset, chFieldFill, nWidth);
 
       /* write record */
-      nRecordOffset = psDBF->nRecordLength * (unsigned long) iRecord + psDBF->nHeaderLength;
-      fseek(psDBF->fp, nRecordOffset, 0);
+      nRecordOffset = psDBF->nRecordLength * (off_t) iRecord + psDBF->nHeaderLength;
+      fseeko(psDBF->fp, nRecordOffset, 0);
       fwrite(pszRecord, psDBF->nRecordLength, 1,psDBF->fp);
     }
 
@@ -1286,8 +2274,8 @@ int DBFAlterFieldDefn(DBFHandle psDBF, int iField, const char *pszFieldName,
     for (iRecord = psDBF->nRecords - 1; iRecord >= 0; iRecord--) {
 
       /* load record */
-      nRecordOffset =  nOldRecordLength * (unsigned long) iRecord + psDBF->nHeaderLength;
-      fseek(psDBF->fp, nRecordOffset, 0);
+      nRecordOffset =  nOldRecordLength * (off_t) iRecord + psDBF->nHeaderLength;
+      fseeko(psDBF->fp, nRecordOffset, 0);
       fread(pszRecord, nOldRecordLength, 1, psDBF->fp);
       memcpy(pszOldField, pszRecord + nOffset, nOldWidth);
       bIsNULL = DBFIsValueNULL(chOldType, pszOldField);
@@ -1309,8 +2297,8 @@ int DBFAlterFieldDefn(DBFHandle psDBF, int iField, const char *pszFieldName,
         }
       }
       /* write record */
-      nRecordOffset = psDBF->nRecordLength * (unsigned long) iRecord + psDBF->nHeaderLength;
-      fseek(psDBF->fp, nRecordOffset, 0);
+      nRecordOffset = psDBF->nRecordLength * (off_t) iRecord + psDBF->nHeaderLength;
+      fseeko(psDBF->fp, nRecordOffset, 0);
       fwrite(pszRecord, psDBF->nRecordLength, 1,psDBF->fp);
     }
     free(pszRecord);
@@ -1320,3 +2308,131 @@ int DBFAlterFieldDefn(DBFHandle psDBF, int iField, const char *pszFieldName,
   psDBF->bCurrentRecordModified = FALSE;
   return TRUE;
 }
+
+/*
+** int record-index versions of the ...64 functions, kept for callers
+** written against the original API.  Files with more records than an
+** int can count need the ...64 functions; DBFGetRecordCount reports
+** them as having INT_MAX records.
+*/
+
+/* DBFGetRecordCount */
+int  DBFGetRecordCount(DBFHandle psDBF) {
+  return (psDBF->nRecords > INT_MAX ? INT_MAX : (int) psDBF->nRecords);
+}
+
+/* DBFReadIntegerAttribute */
+int  DBFReadIntegerAttribute(DBFHandle psDBF, int iRecord, int iField) {
+  return DBFReadIntegerAttribute64(psDBF, iRecord, iField);
+}
+
+/* DBFReadDoubleAttribute */
+double  DBFReadDoubleAttribute(DBFHandle psDBF, int iRecord, int iField) {
+  return DBFReadDoubleAttribute64(psDBF, iRecord, iField);
+}
+
+/* DBFReadStringAttribute */
+const char* DBFReadStringAttribute(DBFHandle psDBF, int iRecord, int iField) {
+  return DBFReadStringAttribute64(psDBF, iRecord, iField);
+}
+
+/* DBFReadLogicalAttribute */
+const char* DBFReadLogicalAttribute(DBFHandle psDBF, int iRecord, int iField) {
+  return DBFReadLogicalAttribute64(psDBF, iRecord, iField);
+}
+
+/* DBFIsAttributeNULL */
+int  DBFIsAttributeNULL(DBFHandle psDBF, int iRecord, int iField) {
+  return DBFIsAttributeNULL64(psDBF, iRecord, iField);
+}
+
+/* DBFGetFieldView */
+int  DBFGetFieldView(DBFHandle psDBF, int iRecord, int iField,
+                     const char **ppachValue, int *pnLength) {
+  return DBFGetFieldView64(psDBF, iRecord, iField, ppachValue, pnLength);
+}
+
+/* DBFWriteIntegerAttribute */
+int  DBFWriteIntegerAttribute(DBFHandle psDBF, int iRecord, int iField, int nValue) {
+  return DBFWriteIntegerAttribute64(psDBF, iRecord, iField, nValue);
+}
+
+/* DBFWriteDoubleAttribute */
+int  DBFWriteDoubleAttribute(DBFHandle psDBF, int iRecord, int iField, double dValue) {
+  return DBFWriteDoubleAttribute64(psDBF, iRecord, iField, dValue);
+}
+
+/* DBFWriteStringAttribute */
+int  DBFWriteStringAttribute(DBFHandle psDBF, int iRecord, int iField, const char *pszValue) {
+  return DBFWriteStringAttribute64(psDBF, iRecord, iField, pszValue);
+}
+
+/* DBFWriteNULLAttribute */
+int  DBFWriteNULLAttribute(DBFHandle psDBF, int iRecord, int iField) {
+  return DBFWriteNULLAttribute64(psDBF, iRecord, iField);
+}
+
+/* DBFWriteLogicalAttribute */
+int  DBFWriteLogicalAttribute(DBFHandle psDBF, int iRecord, int iField, const char lValue) {
+  return DBFWriteLogicalAttribute64(psDBF, iRecord, iField, lValue);
+}
+
+/* DBFWriteAttributeDirectly */
+int  DBFWriteAttributeDirectly(DBFHandle psDBF, int hEntity, int iField, void *pValue) {
+  return DBFWriteAttributeDirectly64(psDBF, hEntity, iField, pValue);
+}
+
+/* DBFReadTuple */
+const char* DBFReadTuple(DBFHandle psDBF, int hEntity) {
+  return DBFReadTuple64(psDBF, hEntity);
+}
+
+/* DBFWriteTuple */
+int  DBFWriteTuple(DBFHandle psDBF, int hEntity, void *pRawTuple) {
+  return DBFWriteTuple64(psDBF, hEntity, pRawTuple);
+}
+
+/* DBFIsRecordDeleted */
+int  DBFIsRecordDeleted(DBFHandle psDBF, int iShape) {
+  return DBFIsRecordDeleted64(psDBF, iShape);
+}
+
+/* DBFMarkRecordDeleted */
+int  DBFMarkRecordDeleted(DBFHandle psDBF, int iShape, int bIsDeleted) {
+  return DBFMarkRecordDeleted64(psDBF, iShape, bIsDeleted);
+}
+
+/* DBFReadRecordBlock */
+int DBFReadRecordBlock(DBFHandle psDBF, int iFirstRecord, int nRecords, char *pachBuffer) {
+  return DBFReadRecordBlock64(psDBF, iFirstRecord, nRecords, pachBuffer);
+}
+
+/* DBFWriteRecordBlock */
+int DBFWriteRecordBlock(DBFHandle psDBF, int iFirstRecord, const char *pachRecords, int nRecords) {
+  return DBFWriteRecordBlock64(psDBF, iFirstRecord, pachRecords, nRecords);
+}
+
+/* DBFScanOpen */
+DBFScanHandle DBFScanOpen(DBFHandle psDBF, int iFirstRecord, int nRecords, int nBlockSize) {
+  return DBFScanOpen64(psDBF, iFirstRecord, nRecords, nBlockSize);
+}
+
+/* DBFScanNextBlock */
+const char* DBFScanNextBlock(DBFScanHandle psScan, int *piFirstRecord, int *pnRecords) {
+  int64_t iFirstRecord;
+  const char *pachBlock = DBFScanNextBlock64(psScan, &iFirstRecord, pnRecords);
+
+  if (pachBlock != NULL && piFirstRecord != NULL)
+    *piFirstRecord = (int) iFirstRecord;
+  return pachBlock;
+}
+
+/* DBFScanNextRecord */
+const char* DBFScanNextRecord(DBFScanHandle psScan, int *piRecord) {
+  int64_t iRecord;
+  const char *pachRecord = DBFScanNextRecord64(psScan, &iRecord);
+
+  if (pachRecord != NULL && piRecord != NULL)
+    *piRecord = (int) iRecord;
+  return pachRecord;
+}
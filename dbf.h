@@ -26,13 +26,25 @@
  ******************************************************************************/
 
 #include <stdio.h>
+#include <stdint.h>
 
 #define TRIM_DBF_WHITESPACE
 #define DISABLE_MULTIPATCH_MEASURE
 
+/* Counts of the calls made to read, write and seek records in the */
+/* file, and of the bytes they moved.  Mapped files need no calls, but */
+/* the bytes of their records are counted as read. */
+typedef struct {
+  int64_t nReads;
+  int64_t nWrites;
+  int64_t nSeeks;
+  int64_t nBytesRead;
+  int64_t nBytesWritten;
+} DBFIOStats;
+
 typedef struct {
   FILE*   fp;
-  int     nRecords;
+  int64_t nRecords;
   int     nRecordLength;
   int     nHeaderLength;
   int     nFields;
@@ -41,7 +53,7 @@ typedef struct {
   int     *panFieldDecimals;
   char    *pachFieldType;
   char    *pszHeader;
-  int     nCurrentRecord;
+  int64_t nCurrentRecord;
   int     bCurrentRecordModified;
   char    *pszCurrentRecord;
   int     nWorkFieldLength;
@@ -51,10 +63,39 @@ typedef struct {
   double  dfDoubleField;
   int     iLanguageDriver;
   char    *pszCodePage;
+  int     bReadOnly;
+  unsigned char *pabyMap;
+  size_t  nMapSize;
+  char    *pachBlock;
+  int64_t nBlockFirst;
+  int     nBlockRecords;
+  int     nBlockCapacity;
+  int     bStream;
+  int64_t iStreamRecord;
+  DBFIOStats sIOStats;
+  char    *pachAppendBlock;
+  size_t  nAppendBlockSize;
+  int     nAppendRecords;
 } DBFInfo;
 
 typedef DBFInfo* DBFHandle;
 
+typedef struct {
+  DBFHandle hDBF;
+  int64_t iNextRecord;
+  int64_t iEndRecord;
+  int     nBlockCapacity;
+  char    *pachBuffer;
+  const char *pachBlock;
+  int64_t iBlockFirst;
+  int     nBlockRecords;
+  int     iBlockPos;
+  struct DBFReadAheadInfo *psAhead;
+  int     bFailed;
+} DBFScanInfo;
+
+typedef DBFScanInfo* DBFScanHandle;
+
 typedef enum {
   FTString,
   FTInteger,
@@ -64,10 +105,12 @@ typedef enum {
 } DBFFieldType;
 
 DBFHandle DBFOpen(const char* filename, const char* pszAccess);
+DBFHandle DBFOpenStream(FILE* fp);
 DBFHandle DBFCreate(const char* filename);
 DBFHandle DBFCreateEx(const char* filename, const char* pszCodePage);
 int DBFGetFieldCount(DBFHandle);
 int DBFGetRecordCount(DBFHandle);
+int DBFGetRecordLength(DBFHandle);
 int DBFAddField(DBFHandle, const char* field, DBFFieldType, int nWidth, int nDecimals);
 int DBFAddNativeFieldType(DBFHandle,const char* field,char chType, int nWidth, int nDecimals);
 int DBFDeleteField(DBFHandle, int iField);
@@ -75,11 +118,17 @@ int DBFReorderFields(DBFHandle, int* panMap);
 int DBFAlterFieldDefn(DBFHandle, int iField,const char* field,char chType,int nWidth,int nDecimals);
 DBFFieldType DBFGetFieldInfo(DBFHandle, int iField, char* field, int* pnWidth, int* pnDecimals);
 int DBFGetFieldIndex(DBFHandle, const char *field);
+int DBFFindField(DBFHandle, const char *field);
 int DBFReadIntegerAttribute(DBFHandle, int iShape, int iField);
 double DBFReadDoubleAttribute(DBFHandle, int iShape, int iField);
 const char* DBFReadStringAttribute(DBFHandle, int iShape, int iField);
 const char* DBFReadLogicalAttribute(DBFHandle, int iShape, int iField);
 int DBFIsAttributeNULL(DBFHandle, int iShape, int iField);
+int DBFGetFieldView(DBFHandle, int iShape, int iField, const char** ppachValue, int* pnLength);
+int DBFGetTupleFieldView(DBFHandle, const char* pachTuple, int iField, const char** ppachValue, int* pnLength);
+int DBFIsFieldViewNULL(DBFHandle, int iField, const char* pachValue, int nLength);
+int DBFReadTupleIntegerAttribute(DBFHandle, const char* pachTuple, int iField);
+double DBFReadTupleDoubleAttribute(DBFHandle, const char* pachTuple, int iField);
 int DBFWriteIntegerAttribute(DBFHandle, int iShape, int iField, int nFieldValue);
 int DBFWriteDoubleAttribute(DBFHandle, int iShape, int iField, double dFieldValue);
 int DBFWriteStringAttribute(DBFHandle, int iShape, int iField, const char* pszFieldValue);
@@ -89,11 +138,52 @@ int DBFWriteAttributeDirectly(DBFHandle, int hEntity, int iField, void * pValue)
 const char* DBFReadTuple(DBFHandle, int hEntity);
 int DBFWriteTuple(DBFHandle, int hEntity, void* pRawTuple);
 int DBFIsRecordDeleted(DBFHandle, int iShape);
+int DBFIsTupleDeleted(DBFHandle, const char* pachTuple);
 int DBFMarkRecordDeleted(DBFHandle, int iShape, int bIsDeleted);
 DBFHandle DBFCloneEmpty(DBFHandle, const char* pszFilename);
 void DBFClose(DBFHandle);
 void DBFUpdateHeader(DBFHandle);
 char DBFGetNativeFieldType(DBFHandle, int iField);
 const char* DBFGetCodePage(DBFHandle);
+int DBFReadRecordBlock(DBFHandle, int iFirstRecord, int nRecords, char* pachBuffer);
+DBFScanHandle DBFScanOpen(DBFHandle, int iFirstRecord, int nRecords, int nBlockSize);
+const char* DBFScanNextBlock(DBFScanHandle, int* piFirstRecord, int* pnRecords);
+const char* DBFScanNextRecord(DBFScanHandle, int* piRecord);
+int DBFScanFailed(DBFScanHandle);
+void DBFScanClose(DBFScanHandle);
+int DBFAppendRecordBlock(DBFHandle, const char* pachRecords, int nRecords);
+int DBFWriteRecordBlock(DBFHandle, int iFirstRecord, const char* pachRecords, int nRecords);
+void DBFBlankTuple(DBFHandle, char* pachTuple);
+int DBFSetTupleIntegerAttribute(DBFHandle, char* pachTuple, int iField, int nFieldValue);
+int DBFSetTupleDoubleAttribute(DBFHandle, char* pachTuple, int iField, double dFieldValue);
+int DBFSetTupleStringAttribute(DBFHandle, char* pachTuple, int iField, const char* pszFieldValue);
+int DBFSetTupleNULLAttribute(DBFHandle, char* pachTuple, int iField);
+int DBFSetTupleLogicalAttribute(DBFHandle, char* pachTuple, int iField, const char lFieldValue);
+int DBFAppendTuple(DBFHandle, const char* pachTuple);
+void DBFGetIOStats(DBFHandle, DBFIOStats* psStats);
+
+/* The same, with 64-bit record indices and counts. */
+int64_t DBFGetRecordCount64(DBFHandle);
+int DBFReadIntegerAttribute64(DBFHandle, int64_t iShape, int iField);
+double DBFReadDoubleAttribute64(DBFHandle, int64_t iShape, int iField);
+const char* DBFReadStringAttribute64(DBFHandle, int64_t iShape, int iField);
+const char* DBFReadLogicalAttribute64(DBFHandle, int64_t iShape, int iField);
+int DBFIsAttributeNULL64(DBFHandle, int64_t iShape, int iField);
+int DBFGetFieldView64(DBFHandle, int64_t iShape, int iField, const char** ppachValue, int* pnLength);
+int DBFWriteIntegerAttribute64(DBFHandle, int64_t iShape, int iField, int nFieldValue);
+int DBFWriteDoubleAttribute64(DBFHandle, int64_t iShape, int iField, double dFieldValue);
+int DBFWriteStringAttribute64(DBFHandle, int64_t iShape, int iField, const char* pszFieldValue);
+int DBFWriteNULLAttribute64(DBFHandle, int64_t iShape, int iField);
+int DBFWriteLogicalAttribute64(DBFHandle, int64_t iShape, int iField, const char lFieldValue);
+int DBFWriteAttributeDirectly64(DBFHandle, int64_t hEntity, int iField, void * pValue);
+const char* DBFReadTuple64(DBFHandle, int64_t hEntity);
+int DBFWriteTuple64(DBFHandle, int64_t hEntity, void* pRawTuple);
+int DBFIsRecordDeleted64(DBFHandle, int64_t iShape);
+int DBFMarkRecordDeleted64(DBFHandle, int64_t iShape, int bIsDeleted);
+int DBFReadRecordBlock64(DBFHandle, int64_t iFirstRecord, int nRecords, char* pachBuffer);
+int DBFWriteRecordBlock64(DBFHandle, int64_t iFirstRecord, const char* pachRecords, int nRecords);
+DBFScanHandle DBFScanOpen64(DBFHandle, int64_t iFirstRecord, int64_t nRecords, int nBlockSize);
+const char* DBFScanNextBlock64(DBFScanHandle, int64_t* piFirstRecord, int* pnRecords);
+const char* DBFScanNextRecord64(DBFScanHandle, int64_t* piRecord);
 
 #endif /* DBF_H_INCLUDED */
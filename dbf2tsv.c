@@ -4,7 +4,8 @@
 ** Released into the public domain by the author.
 **
 ** Converts an xBase/dBase format (DBF) file specified by the argument
-** to a Tab-Separated Value (TSV) file, written on stdout.
+** to a Tab-Separated Value (TSV) file, written on stdout, or (with
+** -a) to an Apache Arrow IPC stream.
 **
 ** DBF functions based on shapelib (shapelib.maptools.org).
 */
@@ -12,68 +13,900 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
 #include "dbf.h"
+#include "arrow.h"
+#include "runstats.h"
 
 #define FS "\t"
 #define RS "\n"
+#define OUT_BUFFER_SIZE (1024*1024)
+#define CHUNK_SIZE      (4*1024*1024)
+#define ARROW_BATCH     65536
+#define USAGE "Usage: dbf2tsv [-a] [-d] [-l] [-r] [-j threads] [-c columns] [-w test]... [--stats] dbf-file\n"
+
+/*
+** Struct for the output columns, with everything needed to format
+** a column's values worked out once, before the data rows.
+*/
+
+typedef struct column_t {
+  int          field;
+  DBFFieldType type;
+  int          width;
+  int          decimals;
+  int          raw;
+  char         fmt[16];
+} column;
+
+/*
+** A --where test of a field against a value, made on the bytes of
+** each record before anything in it is formatted. Numeric fields are
+** compared as numbers (and a NULL number passes no test), others as
+** trimmed text. For equality tests on text, padded holds the value as
+** it would be stored in the field.
+*/
+
+enum { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE, OP_PREFIX };
+
+typedef struct predicate_t {
+  int    field;
+  int    op;
+  int    numeric;
+  double number;
+  char   *text;
+  int    length;
+  char   *padded;
+  int    offset;
+  int    width;
+} predicate;
+
+/*
+** Everything needed to convert records: the output columns, the tests
+** records must pass and whether deleted records are converted too,
+** and, for Arrow output, the writer the records go to instead of the
+** output buffer. The phases of the conversion are timed in rs.
+*/
+
+typedef struct plan_t {
+  DBFHandle    dbf_file;
+  column       *columns;
+  int          num_columns;
+  predicate    *predicates;
+  int          num_predicates;
+  int          deleted;
+  arrow_writer *arrow;
+  runstats     *rs;
+} plan;
+
+/*
+** Output buffer. Formatted values are copied into a large buffer,
+** which is written out only when it is full (or, in line mode, at the
+** end of each row). With no file, the buffer just grows. written
+** counts the bytes written out so far, and writing them is timed as
+** the "write" phase of rs, if it isn't NULL. failed is set if any of
+** them could not be written.
+*/
+
+typedef struct outbuf_t {
+  char     *data;
+  size_t   length;
+  size_t   size;
+  FILE     *fp;
+  int64_t  written;
+  int      failed;
+  runstats *rs;
+} outbuf;
+
+/*
+** State shared by the threads of a parallel (-j) conversion. The
+** records are split into chunks, which the workers format into the
+** buffers of a ring of slots. Chunk k goes in slot k % num_slots, and
+** the main thread writes the slots out in chunk order, so the output
+** is the same as from a single thread. ok is cleared for a chunk whose
+** records could not all be read: the records before the failure are
+** written, as from a single thread, but no chunk after it.
+*/
+
+typedef struct slot_t {
+  int    chunk;
+  int    ok;
+  outbuf out;
+} slot;
+
+typedef struct job_t {
+  plan            *pl;
+  int             chunk_records;
+  int             num_chunks;
+  int             next_chunk;
+  int             written;
+  int64_t         rows;
+  int64_t         values;
+  int             num_slots;
+  slot            *slots;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+} job;
+
+/*
+** Forward declarations
+*/
+
+int   format_record(outbuf* out, plan* pl, const char* record);
+int   transpose_record(plan* pl, const char* record);
+arrow_writer* open_arrow(plan* pl);
+int64_t convert(plan* pl, outbuf* out, int line_mode, int64_t* values);
+int64_t convert_parallel(plan* pl, outbuf* out, int num_threads, int64_t* values);
+void* convert_worker(void* arg);
+int64_t convert_scan(outbuf* out, plan* pl, DBFScanHandle scan, int line_mode,
+                     runstats* rs, int64_t* values);
+void  filter_block(DBFHandle dbf_file, predicate* pred, const char* block,
+                   int num_records, int record_length, char* keep);
+int   test_predicate(DBFHandle dbf_file, predicate* pred, const char* record);
+int   parse_predicate(DBFHandle dbf_file, const char* expr, predicate* pred);
+int   select_columns(DBFHandle dbf_file, const char* list, column* columns);
+int   is_decimal(const char* text);
+int   is_plain_number(const char* value, int length, int decimals, int is_double);
+void  out_init(outbuf* out, FILE* fp, size_t size);
+void  out_flush(outbuf* out);
+void  out_reserve(outbuf* out, size_t n);
+void  out_bytes(outbuf* out, const char* bytes, size_t n);
+void  out_blanks(outbuf* out, size_t n);
+void  out_int(outbuf* out, int value);
+void  out_double(outbuf* out, const char* fmt, double value);
+
+/*
+** Command line options
+*/
+
+static struct option long_options[] = {
+  {"arrow",   no_argument,       NULL, 'a'},
+  {"deleted", no_argument,       NULL, 'd'},
+  {"line",    no_argument,       NULL, 'l'},
+  {"raw",     no_argument,       NULL, 'r'},
+  {"jobs",    required_argument, NULL, 'j'},
+  {"columns", required_argument, NULL, 'c'},
+  {"where",   required_argument, NULL, 'w'},
+  {"stats",   no_argument,       NULL, 'S'},
+  {NULL,      0,                 NULL, 0}
+};
+
+/*
+** Main
+*/
 
 int main(int argc, char **argv){
-  DBFHandle dbf_file = NULL; 
-  int       width, decimals, i, r;
+  DBFHandle dbf_file = NULL;
+  int       i, num_columns, opt;
+  int       line_mode = 0, raw_mode = 0, arrow_mode = 0, num_threads = 1;
+  int       deleted = 0, stats = 0, status = EXIT_SUCCESS;
+  int       streaming;
+  int64_t   rows, values = 0;
   char      title[12];
-  char      fmt[12];
+  char      *column_list = NULL;
+  char      **tests = malloc(argc*sizeof(char*));
+  int       num_tests = 0;
+  column    *columns = NULL;
+  plan      pl;
+  outbuf    out;
+  runstats  rs;
+  DBFIOStats io;
+  long long arrow_bytes = 0;
 
-  // Check that there is one argument, the input filename
-  if (argc!=2) {
-    fprintf(stderr, "Usage: dbf2tsv dbf-file\n");
+  // Options, then one argument, the input filename
+  while ((opt = getopt_long(argc, argv, "adlrj:c:w:", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'a':
+      arrow_mode = 1;
+      break;
+    case 'd':
+      deleted = 1;
+      break;
+    case 'l':
+      line_mode = 1;
+      break;
+    case 'r':
+      raw_mode = 1;
+      break;
+    case 'c':
+      column_list = optarg;
+      break;
+    case 'w':
+      tests[num_tests++] = optarg;
+      break;
+    case 'S':
+      stats = 1;
+      break;
+    case 'j':
+      num_threads = atoi(optarg);
+      if (num_threads >= 1)
+        break;
+      // fall through
+    default:
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  if (argc-optind!=1) {
+    fprintf(stderr, USAGE);
     return EXIT_FAILURE;
   }
 
-  // Open the DBF file.
-  dbf_file = DBFOpen(argv[1], "rb");
+  // Open the DBF file, or read it from stdin if it's "-".
+  runstats_init(&rs, stats);
+  runstats_start(&rs, "open");
+  streaming = strcmp(argv[optind], "-") == 0;
+  if (streaming)
+    dbf_file = DBFOpenStream(stdin);
+  else
+    dbf_file = DBFOpen(argv[optind], "rm");
   if (dbf_file == NULL) {
-    fprintf(stderr, "%s can't be read or is not a DBF file\n", argv[1]);
+    fprintf(stderr, "%s can't be read or is not a DBF file\n", argv[optind]);
     return EXIT_FAILURE;
   }
-    
-  // Header row. Prints names of fields, tab-separated.
-  for (i = 0; i < DBFGetFieldCount(dbf_file); i++ ) {
-    DBFGetFieldInfo(dbf_file, i, title, &width, &decimals);
-    if (i>0)
-      printf(FS);
-    printf("%s", title);
-  }
-  printf(RS);
-
-  // Data rows. Prints values of fields, tab-separated.
-  for (r = 0; r < DBFGetRecordCount(dbf_file); r++) {
-    for (i = 0; i < DBFGetFieldCount(dbf_file); i++) {
-      if (i>0)
-        printf(FS);
-      if (!DBFIsAttributeNULL(dbf_file, r, i)) {
-        switch (DBFGetFieldInfo(dbf_file, i, title, &width, &decimals)) {
-        case FTString:
-          // String values not quoted, which will be a problem if 
-          // a field value includes a tab.
-          printf("%s", DBFReadStringAttribute(dbf_file,r,i));
-          break;
-        case FTInteger:
-          printf("%d", DBFReadIntegerAttribute(dbf_file,r,i));
-          break;
-        case FTDouble:
-          sprintf(fmt,"%%%d.%df",width, decimals);
-          printf(fmt, DBFReadDoubleAttribute(dbf_file,r,i));
-          break;
-        default:
-          break;
-        }
+  out_init(&out, stdout, OUT_BUFFER_SIZE);
+  out.rs = &rs;
+
+  // Choose the fields to output: those listed with -c, or else all
+  // of them.
+  if (column_list != NULL) {
+    columns = malloc((strlen(column_list)/2+1)*sizeof(column));
+    num_columns = select_columns(dbf_file, column_list, columns);
+    if (num_columns == 0)
+      fprintf(stderr, "No fields are listed by -c\n");
+    if (num_columns <= 0) {
+      free(columns);
+      DBFClose(dbf_file);
+      return EXIT_FAILURE;
+    }
+  } else {
+    num_columns = DBFGetFieldCount(dbf_file);
+    columns = malloc((num_columns+1)*sizeof(column));
+    for (i = 0; i < num_columns; i++)
+      columns[i].field = i;
+  }
+
+  // Set up the --where tests.
+  pl.predicates = malloc((num_tests+1)*sizeof(predicate));
+  for (pl.num_predicates = 0; pl.num_predicates < num_tests; pl.num_predicates++) {
+    if (parse_predicate(dbf_file, tests[pl.num_predicates],
+                        &pl.predicates[pl.num_predicates]) < 0) {
+      for (i = 0; i < pl.num_predicates; i++) {
+        free(pl.predicates[i].text);
+        free(pl.predicates[i].padded);
       }
+      free(pl.predicates);
+      free(tests);
+      free(columns);
+      free(out.data);
+      DBFClose(dbf_file);
+      return EXIT_FAILURE;
     }
-    printf(RS);
-    fflush( stdout );
+  }
+
+  // Work out the type and number format of each column, and print
+  // the header row of names of fields, tab-separated.
+  for (i = 0; i < num_columns; i++ ) {
+    columns[i].type = DBFGetFieldInfo(dbf_file, columns[i].field, title,
+                                      &columns[i].width, &columns[i].decimals);
+    sprintf(columns[i].fmt, "%%%d.%df", columns[i].width, columns[i].decimals);
+    columns[i].raw = raw_mode;
+    if (arrow_mode)
+      continue;
+    if (i>0)
+      out_bytes(&out, FS, 1);
+    out_bytes(&out, title, strlen(title));
+  }
+  if (!arrow_mode)
+    out_bytes(&out, RS, 1);
+
+  // Data rows. Arrow batches are built on this thread only, a stream
+  // can only be read in order, and -l writes each row as soon as it is
+  // formatted, so none of them is split into chunks.
+  pl.dbf_file = dbf_file;
+  pl.columns = columns;
+  pl.num_columns = num_columns;
+  pl.deleted = deleted;
+  pl.arrow = arrow_mode ? open_arrow(&pl) : NULL;
+  pl.rs = &rs;
+  if (num_threads > 1 && !arrow_mode && !streaming && !line_mode)
+    rows = convert_parallel(&pl, &out, num_threads, &values);
+  else
+    rows = convert(&pl, &out, line_mode, &values);
+  if (rows < 0) {
+    fprintf(stderr, "%s could not all be converted\n", argv[optind]);
+    status = EXIT_FAILURE;
   }
 
   // Finished
+  runstats_start(&rs, "finish");
+  if (pl.arrow != NULL && arrow_close(pl.arrow, &arrow_bytes) < 0)
+    fprintf(stderr, "The Arrow stream could not be written\n");
+  out_flush(&out);
+  if (out.failed || fflush(stdout) != 0) {
+    fprintf(stderr, "The output could not be written\n");
+    status = EXIT_FAILURE;
+  }
+  DBFGetIOStats(dbf_file, &io);
+  rs.rows = rows;
+  rs.values = values;
+  rs.bytes_in = io.nBytesRead;
+  rs.bytes_out = out.written + arrow_bytes;
+  if (status == EXIT_SUCCESS)
+    runstats_report(&rs, "dbf2tsv", &io, stderr);
+  free(out.data);
+  for (i = 0; i < pl.num_predicates; i++) {
+    free(pl.predicates[i].text);
+    free(pl.predicates[i].padded);
+  }
+  free(pl.predicates);
+  free(tests);
+  free(columns);
   DBFClose(dbf_file);
-  return EXIT_SUCCESS;
+  return status;
+}
+
+// Copies the values of the fields of a record, tab-separated, into
+// the output buffer. Only the record and the (read-only) handle are
+// used, so several threads can call this at once. Returns how many of
+// the values weren't NULL.
+int format_record(outbuf* out, plan* pl, const char* record) {
+  DBFHandle  dbf_file = pl->dbf_file;
+  const char *value;
+  int        i, length, values = 0;
+
+  for (i = 0; i < pl->num_columns; i++) {
+    column *col = &pl->columns[i];
+
+    if (i>0)
+      out_bytes(out, FS, 1);
+    DBFGetTupleFieldView(dbf_file, record, col->field, &value, &length);
+    if (DBFIsFieldViewNULL(dbf_file, col->field, value, length))
+      continue;
+    values++;
+    switch (col->type) {
+    case FTString:
+      // String values not quoted, which will be a problem if
+      // a field value includes a tab. Written straight from the
+      // record, without a copy.
+      out_bytes(out, value, length);
+      break;
+    case FTInteger:
+      // In raw mode, a value already written the way "%d" would write
+      // it is copied as it is.
+      if (col->raw && is_plain_number(value, length, 0, 0))
+        out_bytes(out, value, length);
+      else
+        out_int(out, DBFReadTupleIntegerAttribute(dbf_file, record, col->field));
+      break;
+    case FTDouble:
+      // Likewise for "%W.Df", which pads the value to the field width.
+      if (col->raw && is_plain_number(value, length, col->decimals, 1)) {
+        if (length < col->width)
+          out_blanks(out, col->width - length);
+        out_bytes(out, value, length);
+      } else
+        out_double(out, col->fmt, DBFReadTupleDoubleAttribute(dbf_file, record, col->field));
+      break;
+    default:
+      break;
+    }
+  }
+  out_bytes(out, RS, 1);
+  return values;
+}
+
+// Sets the values of the fields of a record into a row of the Arrow
+// batch. Integer fields are read as doubles, which hold all ten digits
+// exactly, where an int may not. Returns how many of the values
+// weren't NULL.
+int transpose_record(plan* pl, const char* record) {
+  DBFHandle  dbf_file = pl->dbf_file;
+  const char *value;
+  int        i, length, values = 0;
+
+  for (i = 0; i < pl->num_columns; i++) {
+    column *col = &pl->columns[i];
+
+    DBFGetTupleFieldView(dbf_file, record, col->field, &value, &length);
+    if (DBFIsFieldViewNULL(dbf_file, col->field, value, length)) {
+      arrow_set_null(pl->arrow, i);
+      continue;
+    }
+    values++;
+    switch (col->type) {
+    case FTInteger:
+      arrow_set_int64(pl->arrow, i,
+                      (long long) DBFReadTupleDoubleAttribute(dbf_file, record, col->field));
+      break;
+    case FTDouble:
+      arrow_set_float64(pl->arrow, i, DBFReadTupleDoubleAttribute(dbf_file, record, col->field));
+      break;
+    case FTLogical:
+      if (length > 0 && strchr("TtYy", value[0]) != NULL)
+        arrow_set_bool(pl->arrow, i, 1);
+      else if (length > 0 && strchr("FfNn", value[0]) != NULL)
+        arrow_set_bool(pl->arrow, i, 0);
+      else
+        arrow_set_null(pl->arrow, i);
+      break;
+    default:
+      arrow_set_utf8(pl->arrow, i, value, length);
+      break;
+    }
+  }
+  arrow_end_row(pl->arrow);
+  return values;
+}
+
+// Starts an Arrow stream on stdout, with a column for each output
+// field: Int64, Float64, Boolean or (for everything else) Utf8.
+arrow_writer* open_arrow(plan* pl) {
+  char          **names = malloc((pl->num_columns+1)*sizeof(char*));
+  arrow_type    *types = malloc((pl->num_columns+1)*sizeof(arrow_type));
+  arrow_writer  *w;
+  int           i;
+
+  for (i = 0; i < pl->num_columns; i++) {
+    names[i] = malloc(12);
+    DBFGetFieldInfo(pl->dbf_file, pl->columns[i].field, names[i], NULL, NULL);
+    switch (pl->columns[i].type) {
+    case FTInteger: types[i] = ARROW_INT64;   break;
+    case FTDouble:  types[i] = ARROW_FLOAT64; break;
+    case FTLogical: types[i] = ARROW_BOOL;    break;
+    default:        types[i] = ARROW_UTF8;    break;
+    }
+  }
+  w = arrow_open(stdout, pl->num_columns, names, types, ARROW_BATCH);
+  for (i = 0; i < pl->num_columns; i++)
+    free(names[i]);
+  free(names);
+  free(types);
+  return w;
+}
+
+// Converts all the records in order on this thread, returning how
+// many were converted, or -1 if they could not all be read, and
+// adding the values which weren't NULL to *values. Reading the
+// records and formatting them are timed as separate phases.
+int64_t convert(plan* pl, outbuf* out, int line_mode, int64_t* values) {
+  DBFScanHandle scan = DBFScanOpen(pl->dbf_file, 0, -1, 0);
+  int64_t       rows = convert_scan(out, pl, scan, line_mode, pl->rs, values);
+
+  DBFScanClose(scan);
+  return rows;
+}
+
+// Converts the records on num_threads worker threads, writing the
+// formatted chunks out in order from this thread. Returns how many
+// records were converted, or -1 if they could not all be read, and
+// adds the values which weren't NULL to *values. The workers read and
+// format at once, so this thread's waits for them are timed as the
+// "wait" phase, and its writes as the "write" phase. If fewer threads
+// can be started than were asked for, those that were do all the
+// chunks; if none can be, nothing is converted. A failed write is
+// recorded in out, and nothing is written after it.
+int64_t convert_parallel(plan* pl, outbuf* out, int num_threads, int64_t* values) {
+  job       jb;
+  pthread_t *threads;
+  int       i, k, ok = 1, num_started;
+  int64_t   num_records = DBFGetRecordCount64(pl->dbf_file);
+  int       record_length = DBFGetRecordLength(pl->dbf_file);
+
+  jb.pl = pl;
+  jb.chunk_records = CHUNK_SIZE / (record_length > 0 ? record_length : 1);
+  if (jb.chunk_records < 1)
+    jb.chunk_records = 1;
+  jb.num_chunks = (num_records + jb.chunk_records - 1) / jb.chunk_records;
+  jb.next_chunk = 0;
+  jb.written = 0;
+  jb.rows = 0;
+  jb.values = 0;
+  jb.num_slots = 2 * num_threads;
+  jb.slots = malloc(jb.num_slots * sizeof(slot));
+  for (i = 0; i < jb.num_slots; i++) {
+    jb.slots[i].chunk = -1;
+    out_init(&jb.slots[i].out, NULL, OUT_BUFFER_SIZE);
+  }
+  pthread_mutex_init(&jb.lock, NULL);
+  pthread_cond_init(&jb.cond, NULL);
+
+  threads = malloc(num_threads * sizeof(pthread_t));
+  for (num_started = 0; num_started < num_threads; num_started++)
+    if (pthread_create(&threads[num_started], NULL, convert_worker, &jb) != 0)
+      break;
+  if (num_started == 0) {
+    fprintf(stderr, "No threads could be started to convert the records\n");
+    ok = 0;
+    jb.num_chunks = 0;
+  }
+
+  out_flush(out);
+  for (k = 0; k < jb.num_chunks; k++) {
+    slot *s = &jb.slots[k % jb.num_slots];
+
+    runstats_start(pl->rs, "wait");
+    pthread_mutex_lock(&jb.lock);
+    while (s->chunk != k)
+      pthread_cond_wait(&jb.cond, &jb.lock);
+    pthread_mutex_unlock(&jb.lock);
+
+    runstats_start(pl->rs, "write");
+    if (ok && !out->failed) {
+      if (fwrite(s->out.data, 1, s->out.length, stdout) == s->out.length)
+        out->written += s->out.length;
+      else
+        out->failed = 1;
+    }
+    ok = ok && s->ok;
+
+    pthread_mutex_lock(&jb.lock);
+    s->chunk = -1;
+    jb.written = k+1;
+    pthread_cond_broadcast(&jb.cond);
+    pthread_mutex_unlock(&jb.lock);
+  }
+
+  for (i = 0; i < num_started; i++)
+    pthread_join(threads[i], NULL);
+  for (i = 0; i < jb.num_slots; i++)
+    free(jb.slots[i].out.data);
+  free(jb.slots);
+  free(threads);
+  pthread_mutex_destroy(&jb.lock);
+  pthread_cond_destroy(&jb.cond);
+  *values += jb.values;
+  return ok ? jb.rows : -1;
+}
+
+// Worker thread for convert_parallel. Takes the next chunk, waits for
+// its slot to be written out and freed, and formats the chunk's
+// records into the slot's buffer, using its own scan of the records.
+void* convert_worker(void* arg) {
+  job *jb = arg;
+
+  pthread_mutex_lock(&jb->lock);
+  for (;;) {
+    int           k = jb->next_chunk++;
+    slot          *s = &jb->slots[k % jb->num_slots];
+    DBFScanHandle scan;
+    int64_t       rows, values = 0;
+
+    if (k >= jb->num_chunks)
+      break;
+    while (k - jb->written >= jb->num_slots)
+      pthread_cond_wait(&jb->cond, &jb->lock);
+    pthread_mutex_unlock(&jb->lock);
+
+    s->out.length = 0;
+    scan = DBFScanOpen64(jb->pl->dbf_file, (int64_t) k * jb->chunk_records, jb->chunk_records, 0);
+    rows = convert_scan(&s->out, jb->pl, scan, 0, NULL, &values);
+    DBFScanClose(scan);
+
+    pthread_mutex_lock(&jb->lock);
+    s->chunk = k;
+    s->ok = rows >= 0;
+    if (rows > 0)
+      jb->rows += rows;
+    jb->values += values;
+    pthread_cond_broadcast(&jb->cond);
+  }
+  pthread_mutex_unlock(&jb->lock);
+  return NULL;
+}
+
+// Converts the records of a scan, a block at a time. Deleted records
+// are dropped first, on their flag bytes alone, then the --where tests
+// are run over the whole block, and then the records which passed
+// them all are formatted. Returns how many were, or -1 if the scan
+// stopped short of its records, and adds the values which weren't NULL
+// to *values. Unless rs is NULL, the time taken getting each block is
+// timed in it as the "read" phase, and the rest as "format".
+int64_t convert_scan(outbuf* out, plan* pl, DBFScanHandle scan, int line_mode,
+                     runstats* rs, int64_t* values) {
+  const char *block;
+  char       *keep = NULL;
+  int        i, num_records, keep_size = 0;
+  int        record_length = DBFGetRecordLength(pl->dbf_file);
+  int64_t    rows = 0;
+
+  for (;;) {
+    runstats_start(rs, "read");
+    block = DBFScanNextBlock(scan, NULL, &num_records);
+    runstats_start(rs, "format");
+    if (block == NULL)
+      break;
+    if (num_records > keep_size) {
+      keep_size = num_records;
+      keep = realloc(keep, keep_size);
+    }
+    for (i = 0; i < num_records; i++)
+      keep[i] = pl->deleted || !DBFIsTupleDeleted(pl->dbf_file, block + (size_t) i * record_length);
+    for (i = 0; i < pl->num_predicates; i++)
+      filter_block(pl->dbf_file, &pl->predicates[i], block, num_records,
+                   record_length, keep);
+    for (i = 0; i < num_records; i++) {
+      if (!keep[i])
+        continue;
+      rows++;
+      if (pl->arrow != NULL) {
+        *values += transpose_record(pl, block + (size_t) i * record_length);
+        continue;
+      }
+      *values += format_record(out, pl, block + (size_t) i * record_length);
+      if (line_mode)
+        out_flush(out);
+    }
+  }
+  free(keep);
+  return DBFScanFailed(scan) ? -1 : rows;
+}
+
+// Runs one --where test over a block of records, clearing keep[] for
+// those which fail.
+void filter_block(DBFHandle dbf_file, predicate* pred, const char* block,
+                  int num_records, int record_length, char* keep) {
+  const char *record = block;
+  int        i;
+
+  for (i = 0; i < num_records; i++, record += record_length) {
+    if (keep[i] && !test_predicate(dbf_file, pred, record))
+      keep[i] = 0;
+  }
+}
+
+// Tests a field of a record, without decoding it where possible.
+int test_predicate(DBFHandle dbf_file, predicate* pred, const char* record) {
+  const char *field = record + pred->offset, *value;
+  int        length, cmp;
+
+  // Text values are stored left-aligned and blank-padded, so an equal
+  // value is nearly always equal byte for byte. And if the field
+  // doesn't start with a blank (or NUL), its first byte must match.
+  if (pred->padded != NULL) {
+    if (memcmp(field, pred->padded, pred->width) == 0)
+      return pred->op == OP_EQ;
+    if (field[0] != ' ' && field[0] != '\0' && field[0] != pred->text[0])
+      return pred->op == OP_NE;
+  }
+
+  DBFGetTupleFieldView(dbf_file, record, pred->field, &value, &length);
+  if (pred->numeric) {
+    double number;
+
+    if (DBFIsFieldViewNULL(dbf_file, pred->field, value, length))
+      return 0;
+    number = DBFReadTupleDoubleAttribute(dbf_file, record, pred->field);
+    cmp = (number > pred->number) - (number < pred->number);
+  } else if (pred->op == OP_PREFIX) {
+    return length >= pred->length && memcmp(value, pred->text, pred->length) == 0;
+  } else {
+    cmp = memcmp(value, pred->text, length < pred->length ? length : pred->length);
+    if (cmp == 0)
+      cmp = length - pred->length;
+  }
+
+  switch (pred->op) {
+  case OP_EQ: return cmp == 0;
+  case OP_NE: return cmp != 0;
+  case OP_LT: return cmp < 0;
+  case OP_LE: return cmp <= 0;
+  case OP_GT: return cmp > 0;
+  case OP_GE: return cmp >= 0;
+  default:    return 0;
+  }
+}
+
+// Parses a --where test, of the form field=value, where the operator
+// may be one of = == != < <= > >= or ^= (starts with), and the field
+// is a name or (0-based) number. Returns 0, or -1 if it's no good.
+int parse_predicate(DBFHandle dbf_file, const char* expr, predicate* pred) {
+  static const struct { const char* text; int op; } ops[] = {
+    {"^=", OP_PREFIX}, {"!=", OP_NE}, {"<=", OP_LE}, {">=", OP_GE},
+    {"==", OP_EQ}, {"=", OP_EQ}, {"<", OP_LT}, {">", OP_GT}
+  };
+  size_t     n = strcspn(expr, "=!<>^");
+  char       *name = strndup(expr, n);
+  const char *value = NULL;
+  DBFFieldType type;
+  int        i;
+
+  memset(pred, 0, sizeof(predicate));
+  for (i = 0; i < (int) (sizeof(ops)/sizeof(ops[0])); i++) {
+    if (strncmp(expr + n, ops[i].text, strlen(ops[i].text)) == 0) {
+      pred->op = ops[i].op;
+      value = expr + n + strlen(ops[i].text);
+      break;
+    }
+  }
+  if (value == NULL || n == 0) {
+    fprintf(stderr, "%s is not a test of the form field=value\n", expr);
+    free(name);
+    return -1;
+  }
+  pred->field = DBFFindField(dbf_file, name);
+  if (pred->field < 0) {
+    fprintf(stderr, "%s is not a field of the DBF file\n", name);
+    free(name);
+    return -1;
+  }
+  free(name);
+
+  // Fields follow the deleted flag in the record, in order.
+  for (i = 0, pred->offset = 1; i < pred->field; i++) {
+    int width;
+    DBFGetFieldInfo(dbf_file, i, NULL, &width, NULL);
+    pred->offset += width;
+  }
+  type = DBFGetFieldInfo(dbf_file, pred->field, NULL, &pred->width, NULL);
+  pred->text = strdup(value);
+  pred->length = strlen(value);
+  pred->numeric = (type == FTInteger || type == FTDouble) && pred->op != OP_PREFIX;
+  if (pred->numeric) {
+    pred->number = strtod(value, NULL);
+    if (!is_decimal(value) || !isfinite(pred->number)) {
+      fprintf(stderr, "%s is not a number\n", value);
+      free(pred->text);
+      pred->text = NULL;
+      return -1;
+    }
+  } else if ((pred->op == OP_EQ || pred->op == OP_NE)
+             && pred->length <= pred->width
+             && (pred->length == 0
+                 || (value[0] != ' ' && value[pred->length-1] != ' '))) {
+    pred->padded = malloc(pred->width);
+    memset(pred->padded, ' ', pred->width);
+    memcpy(pred->padded, value, pred->length);
+  }
+  return 0;
+}
+
+// Looks up a comma-separated list of field names or (0-based) field
+// numbers, putting the fields into the columns array in the order
+// listed. Returns the number of columns, or -1 if a field is unknown.
+int select_columns(DBFHandle dbf_file, const char* list, column* columns) {
+  char *copy = strdup(list), *name, *save = NULL;
+  int  n = 0, field;
+
+  for (name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+    field = DBFFindField(dbf_file, name);
+    if (field < 0) {
+      fprintf(stderr, "%s is not a field of the DBF file\n", name);
+      free(copy);
+      return -1;
+    }
+    columns[n++].field = field;
+  }
+  free(copy);
+  return n;
+}
+
+// Checks whether text is a decimal number as a numeric field holds
+// one: an optional sign, then digits with at most one decimal point.
+// strtod would also take exponents, hex, infinities and NaNs.
+int is_decimal(const char* text) {
+  size_t digits;
+
+  if (*text == '+' || *text == '-')
+    text++;
+  digits = strspn(text, "0123456789");
+  text += digits;
+  if (*text == '.') {
+    text++;
+    digits += strspn(text, "0123456789");
+    text += strspn(text, "0123456789");
+  }
+  return digits > 0 && *text == '\0';
+}
+
+// Checks whether the text of a numeric field is exactly what printf
+// would write for its value: "%d" for an integer column, or "%W.Df",
+// less the padding, for a double column with the given decimals.
+// That is, an optional minus sign, digits without leading zeros, and
+// a point with exactly that many decimals. "%d" never writes "-0".
+int is_plain_number(const char* value, int length, int decimals, int is_double) {
+  int i = 0, digits;
+
+  if (length > 0 && value[0] == '-')
+    i++;
+  for (digits = 0; i < length && value[i] >= '0' && value[i] <= '9'; i++)
+    digits++;
+  if (digits == 0 || (digits > 1 && value[i-digits] == '0'))
+    return 0;
+  if (!is_double && digits == 1 && value[0] == '-' && value[1] == '0')
+    return 0;
+  if (decimals > 0) {
+    if (i >= length || value[i++] != '.')
+      return 0;
+    for (digits = 0; i < length && value[i] >= '0' && value[i] <= '9'; i++)
+      digits++;
+    if (digits != decimals)
+      return 0;
+  }
+  return i == length;
+}
+
+// Sets up an output buffer of the given size, written to fp when it
+// fills, or growing as needed if fp is NULL.
+void out_init(outbuf* out, FILE* fp, size_t size) {
+  out->data = malloc(size);
+  out->length = 0;
+  out->size = size;
+  out->fp = fp;
+  out->written = 0;
+  out->failed = 0;
+  out->rs = NULL;
+}
+
+// Writes out and empties the output buffer, timing the write as its
+// own phase and then going back to the phase it was called in.
+void out_flush(outbuf* out) {
+  if (out->fp != NULL && out->length > 0) {
+    const char *phase = runstats_start(out->rs, "write");
+    if (fwrite(out->data, 1, out->length, out->fp) != out->length
+        || fflush(out->fp) != 0)
+      out->failed = 1;
+    out->written += out->length;
+    out->length = 0;
+    runstats_start(out->rs, phase);
+  }
+}
+
+// Makes room for n more bytes in the output buffer.
+void out_reserve(outbuf* out, size_t n) {
+  if (out->length + n <= out->size)
+    return;
+  out_flush(out);
+  if (out->length + n > out->size) {
+    while (out->length + n > out->size)
+      out->size *= 2;
+    out->data = realloc(out->data, out->size);
+  }
+}
+
+// Copies bytes into the output buffer.
+void out_bytes(outbuf* out, const char* bytes, size_t n) {
+  out_reserve(out, n);
+  memcpy(out->data + out->length, bytes, n);
+  out->length += n;
+}
+
+// Puts n blanks into the output buffer.
+void out_blanks(outbuf* out, size_t n) {
+  out_reserve(out, n);
+  memset(out->data + out->length, ' ', n);
+  out->length += n;
+}
+
+// Formats an integer into the output buffer, as printf's "%d" would.
+void out_int(outbuf* out, int value) {
+  char digits[12];
+  int  n = sizeof(digits);
+  unsigned int u = value < 0 ? 0u - (unsigned int) value : (unsigned int) value;
+
+  do {
+    digits[--n] = '0' + u % 10;
+    u /= 10;
+  } while (u != 0);
+  if (value < 0)
+    digits[--n] = '-';
+  out_bytes(out, digits + n, sizeof(digits) - n);
+}
+
+// Formats a double into the output buffer with the column's
+// precomputed format.
+void out_double(outbuf* out, const char* fmt, double value) {
+  int n;
+
+  out_reserve(out, 64);
+  n = snprintf(out->data + out->length, out->size - out->length, fmt, value);
+  if (n >= (int) (out->size - out->length)) {
+    out_reserve(out, n + 1);
+    n = snprintf(out->data + out->length, out->size - out->length, fmt, value);
+  }
+  out->length += n;
 }
@@ -0,0 +1,332 @@
+/*
+** dbfidx.c
+**
+** Sorted key indexes of a field of a DBF file.  The index is a sidecar
+** file holding a (key, record number) entry for each record, not
+** deleted, whose value of the field isn't NULL, sorted by key, so that
+** the records with a given value are found by binary search and then
+** read with DBFReadTuple, instead of by scanning the whole file.
+**
+** The file is a 64 byte header followed by the entries, all fixed
+** width, with numbers stored little-endian:
+**
+**    0  "DBFIDX1\0"
+**    8  key width (4 bytes)
+**   12  entry size (4 bytes): the key width + 8
+**   16  number of entries (8 bytes)
+**   24  number of records in the DBF file when indexed (8 bytes)
+**   32  record length of the DBF file (4 bytes)
+**   36  field name (11 bytes, NUL padded)
+**   47  native field type
+**   48  1 if the keys are numbers, 0 if text
+**   64  entries: key, then record number (8 bytes)
+**
+** Text keys are the trimmed values, NUL padded to the field width, so
+** that they sort as strings do.  Numeric keys are 8 bytes: the double
+** value, big-endian, with the sign bit flipped for positive numbers and
+** all the bits flipped for negative ones, so that they sort as numbers.
+** Either way keys are compared with memcmp.
+*/
+
+#include "dbfidx.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef FALSE
+#define FALSE       0
+#define TRUE        1
+#endif
+
+#define DBFIDX_MAGIC "DBFIDX1"
+#define DBFIDX_HEADER_SIZE 64
+
+/* DBFIndexPut */
+/* Stores a little-endian number of nBytes bytes. */
+static void DBFIndexPut(unsigned char *pabyDest, uint64_t nValue, int nBytes) {
+  int i;
+  for (i = 0; i < nBytes; i++, nValue >>= 8)
+    pabyDest[i] = (unsigned char) nValue;
+}
+
+/* DBFIndexGet */
+static uint64_t DBFIndexGet(const unsigned char *pabySrc, int nBytes) {
+  uint64_t nValue = 0;
+  int i;
+  for (i = nBytes - 1; i >= 0; i--)
+    nValue = (nValue << 8) | pabySrc[i];
+  return nValue;
+}
+
+/* DBFIndexEncodeDouble */
+/* Makes the 8 byte key of a number, which sorts with memcmp as the */
+/* numbers do. */
+static void DBFIndexEncodeDouble(double dfValue, unsigned char *pabyKey) {
+  uint64_t nBits;
+  int i;
+
+  if (dfValue == 0.0)
+    dfValue = 0.0;              /* -0 is 0 */
+  memcpy(&nBits, &dfValue, 8);
+  if (nBits >> 63)
+    nBits = ~nBits;
+  else
+    nBits |= (uint64_t) 1 << 63;
+  for (i = 0; i < 8; i++)
+    pabyKey[i] = (unsigned char) (nBits >> (56 - 8 * i));
+}
+
+/* DBFIndexSort */
+/* Sorts the entries by key with a bottom-up merge sort.  The sort is */
+/* stable, so entries with equal keys stay in record order.  pabyTemp */
+/* must be as large as the entries. */
+static void DBFIndexSort(unsigned char *pabyEntries, unsigned char *pabyTemp,
+                         int64_t nEntries, int nEntrySize, int nKeyWidth) {
+  unsigned char *pabySrc = pabyEntries, *pabyDst = pabyTemp, *pabySwap;
+  int64_t nRun, iStart, i, j, iMid, iEnd, k;
+
+  for (nRun = 1; nRun < nEntries; nRun *= 2) {
+    for (iStart = 0; iStart < nEntries; iStart += 2 * nRun) {
+      iMid = iStart + nRun < nEntries ? iStart + nRun : nEntries;
+      iEnd = iStart + 2 * nRun < nEntries ? iStart + 2 * nRun : nEntries;
+      i = iStart;
+      j = iMid;
+      for (k = iStart; k < iEnd; k++) {
+        const unsigned char *pabyFrom;
+        if (j >= iEnd || (i < iMid && memcmp(pabySrc + i * nEntrySize,
+                                             pabySrc + j * nEntrySize, nKeyWidth) <= 0))
+          pabyFrom = pabySrc + i++ * nEntrySize;
+        else
+          pabyFrom = pabySrc + j++ * nEntrySize;
+        memcpy(pabyDst + k * nEntrySize, pabyFrom, nEntrySize);
+      }
+    }
+    pabySwap = pabySrc;
+    pabySrc = pabyDst;
+    pabyDst = pabySwap;
+  }
+  if (pabySrc != pabyEntries)
+    memcpy(pabyEntries, pabySrc, (size_t) nEntries * nEntrySize);
+}
+
+/* DBFIndexCreate */
+/* Indexes a field of a DBF file, writing the index to pszFilename. */
+/* Deleted records, and those whose value of the field is NULL, */
+/* aren't indexed.  No index is written unless every record is read. */
+int  DBFIndexCreate(DBFHandle psDBF, int iField, const char *pszFilename) {
+  unsigned char abyHeader[DBFIDX_HEADER_SIZE], *pabyEntries, *pabyTemp, *pabyEntry;
+  char szName[12];
+  const char *pachRecord, *pachValue;
+  int nWidth, nKeyWidth, nEntrySize, nLength, bNumeric, bSorted = TRUE;
+  int64_t nRecords = DBFGetRecordCount64(psDBF), nEntries = 0, iRecord;
+  DBFFieldType eType;
+  DBFScanHandle psScan;
+  FILE *fp;
+
+  eType = DBFGetFieldInfo(psDBF, iField, szName, &nWidth, NULL);
+  if (eType == FTInvalid)
+    return FALSE;
+  bNumeric = eType == FTInteger || eType == FTDouble;
+  nKeyWidth = bNumeric ? 8 : nWidth;
+  nEntrySize = nKeyWidth + 8;
+
+  pabyEntries = (unsigned char *) malloc((size_t) nRecords * nEntrySize + 1);
+  if (pabyEntries == NULL) {
+    fprintf(stderr, "Not enough memory to index %lld records.\n", (long long) nRecords);
+    return FALSE;
+  }
+
+  /* Make the entries, in record order. */
+  psScan = DBFScanOpen64(psDBF, 0, -1, 0);
+  while (psScan != NULL && (pachRecord = DBFScanNextRecord64(psScan, &iRecord)) != NULL) {
+    if (DBFIsTupleDeleted(psDBF, pachRecord))
+      continue;
+    DBFGetTupleFieldView(psDBF, pachRecord, iField, &pachValue, &nLength);
+    if (DBFIsFieldViewNULL(psDBF, iField, pachValue, nLength))
+      continue;
+    pabyEntry = pabyEntries + nEntries * nEntrySize;
+    if (bNumeric) {
+      DBFIndexEncodeDouble(DBFReadTupleDoubleAttribute(psDBF, pachRecord, iField), pabyEntry);
+    } else {
+      memcpy(pabyEntry, pachValue, nLength);
+      memset(pabyEntry + nLength, 0, nKeyWidth - nLength);
+    }
+    DBFIndexPut(pabyEntry + nKeyWidth, iRecord, 8);
+    if (nEntries > 0 && bSorted
+        && memcmp(pabyEntry - nEntrySize, pabyEntry, nKeyWidth) > 0)
+      bSorted = FALSE;
+    nEntries++;
+  }
+  if (DBFScanFailed(psScan)) {
+    fprintf(stderr, "Not all of the %lld records could be read to index.\n",
+            (long long) nRecords);
+    DBFScanClose(psScan);
+    free(pabyEntries);
+    return FALSE;
+  }
+  DBFScanClose(psScan);
+
+  /* Sort them by key, unless they already are. */
+  if (!bSorted) {
+    pabyTemp = (unsigned char *) malloc((size_t) nEntries * nEntrySize + 1);
+    if (pabyTemp == NULL) {
+      fprintf(stderr, "Not enough memory to index %lld records.\n", (long long) nRecords);
+      free(pabyEntries);
+      return FALSE;
+    }
+    DBFIndexSort(pabyEntries, pabyTemp, nEntries, nEntrySize, nKeyWidth);
+    free(pabyTemp);
+  }
+
+  memset(abyHeader, 0, sizeof(abyHeader));
+  memcpy(abyHeader, DBFIDX_MAGIC, sizeof(DBFIDX_MAGIC));
+  DBFIndexPut(abyHeader + 8, nKeyWidth, 4);
+  DBFIndexPut(abyHeader + 12, nEntrySize, 4);
+  DBFIndexPut(abyHeader + 16, nEntries, 8);
+  DBFIndexPut(abyHeader + 24, nRecords, 8);
+  DBFIndexPut(abyHeader + 32, DBFGetRecordLength(psDBF), 4);
+  memcpy(abyHeader + 36, szName, strlen(szName));
+  abyHeader[47] = (unsigned char) DBFGetNativeFieldType(psDBF, iField);
+  abyHeader[48] = (unsigned char) bNumeric;
+
+  fp = fopen(pszFilename, "wb");
+  if (fp == NULL) {
+    free(pabyEntries);
+    return FALSE;
+  }
+  if (fwrite(abyHeader, sizeof(abyHeader), 1, fp) != 1
+      || (nEntries > 0 && fwrite(pabyEntries, (size_t) nEntries * nEntrySize, 1, fp) != 1)
+      || fclose(fp) != 0) {
+    fprintf(stderr, "Failure writing index file %s.\n", pszFilename);
+    free(pabyEntries);
+    return FALSE;
+  }
+  free(pabyEntries);
+  return TRUE;
+}
+
+/* DBFIndexOpen */
+/* Opens an index file, mapping it into memory.  Returns NULL if it */
+/* can't be read or isn't an index file. */
+DBFIndexHandle  DBFIndexOpen(const char *pszFilename) {
+  DBFIndexHandle psIndex;
+  struct stat sStat;
+  void *pMap;
+  FILE *fp = fopen(pszFilename, "rb");
+
+  if (fp == NULL)
+    return NULL;
+  if (fstat(fileno(fp), &sStat) != 0 || sStat.st_size < DBFIDX_HEADER_SIZE
+      || (unsigned long long) sStat.st_size != (size_t) sStat.st_size) {
+    fclose(fp);
+    return NULL;
+  }
+  pMap = mmap(NULL, (size_t) sStat.st_size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+  fclose(fp);
+  if (pMap == MAP_FAILED)
+    return NULL;
+
+  psIndex = (DBFIndexHandle) calloc(1, sizeof(DBFIndexInfo));
+  psIndex->pabyMap = (unsigned char *) pMap;
+  psIndex->nMapSize = (size_t) sStat.st_size;
+  psIndex->pabyEntries = psIndex->pabyMap + DBFIDX_HEADER_SIZE;
+  psIndex->nKeyWidth = (int) DBFIndexGet(psIndex->pabyMap + 8, 4);
+  psIndex->nEntrySize = (int) DBFIndexGet(psIndex->pabyMap + 12, 4);
+  psIndex->nEntries = (int64_t) DBFIndexGet(psIndex->pabyMap + 16, 8);
+  psIndex->nDBFRecords = (int64_t) DBFIndexGet(psIndex->pabyMap + 24, 8);
+  psIndex->nDBFRecordLength = (int) DBFIndexGet(psIndex->pabyMap + 32, 4);
+  memcpy(psIndex->szFieldName, psIndex->pabyMap + 36, 11);
+  psIndex->chFieldType = (char) psIndex->pabyMap[47];
+  psIndex->bNumeric = psIndex->pabyMap[48];
+
+  if (memcmp(psIndex->pabyMap, DBFIDX_MAGIC, sizeof(DBFIDX_MAGIC)) != 0
+      || psIndex->nKeyWidth <= 0 || psIndex->nEntrySize != psIndex->nKeyWidth + 8
+      || psIndex->nEntries < 0
+      || (uint64_t) psIndex->nEntries > (psIndex->nMapSize - DBFIDX_HEADER_SIZE) / psIndex->nEntrySize) {
+    DBFIndexClose(psIndex);
+    return NULL;
+  }
+  return psIndex;
+}
+
+/* DBFIndexMatches */
+/* Checks that an index could be of a DBF file: that the file still */
+/* has the number and length of records it had when indexed. */
+int  DBFIndexMatches(DBFIndexHandle psIndex, DBFHandle psDBF) {
+  return psIndex->nDBFRecords == DBFGetRecordCount64(psDBF)
+    && psIndex->nDBFRecordLength == DBFGetRecordLength(psDBF);
+}
+
+/* DBFIndexLowerBound */
+/* Returns the first entry whose key isn't less than pabyKey, or */
+/* (if bAfter) is greater than it. */
+static int64_t DBFIndexLowerBound(DBFIndexHandle psIndex, const unsigned char *pabyKey, int bAfter) {
+  int64_t iLow = 0, iHigh = psIndex->nEntries, iMid;
+
+  while (iLow < iHigh) {
+    int nCmp;
+    iMid = iLow + (iHigh - iLow) / 2;
+    nCmp = memcmp(psIndex->pabyEntries + iMid * psIndex->nEntrySize, pabyKey, psIndex->nKeyWidth);
+    if (nCmp < 0 || (bAfter && nCmp == 0))
+      iLow = iMid + 1;
+    else
+      iHigh = iMid;
+  }
+  return iLow;
+}
+
+/* DBFIndexFind */
+/* Finds the entries for the records whose value of the field is */
+/* pszKey (as text, even for numeric fields).  Returns the number of */
+/* them, and sets *piFirstEntry to the first, for DBFIndexGetRecord. */
+int64_t  DBFIndexFind(DBFIndexHandle psIndex, const char *pszKey, int64_t *piFirstEntry) {
+  unsigned char abyKey[256], *pabyKey = abyKey;
+  int64_t iFirst, iEnd;
+  size_t nLength = strlen(pszKey);
+
+  if (piFirstEntry != NULL)
+    *piFirstEntry = 0;
+
+  if (psIndex->bNumeric) {
+    char *pszEnd;
+    double dfValue = strtod(pszKey, &pszEnd);
+    if (pszEnd == pszKey || pszEnd[strspn(pszEnd, " ")] != '\0')
+      return 0;
+    DBFIndexEncodeDouble(dfValue, abyKey);
+  } else {
+    if (nLength > (size_t) psIndex->nKeyWidth)
+      return 0;
+    if (psIndex->nKeyWidth > (int) sizeof(abyKey))
+      pabyKey = (unsigned char *) malloc(psIndex->nKeyWidth);
+    memcpy(pabyKey, pszKey, nLength);
+    memset(pabyKey + nLength, 0, psIndex->nKeyWidth - nLength);
+  }
+
+  iFirst = DBFIndexLowerBound(psIndex, pabyKey, FALSE);
+  iEnd = DBFIndexLowerBound(psIndex, pabyKey, TRUE);
+  if (pabyKey != abyKey)
+    free(pabyKey);
+  if (piFirstEntry != NULL)
+    *piFirstEntry = iFirst;
+  return iEnd - iFirst;
+}
+
+/* DBFIndexGetRecord */
+/* Returns the record number of an entry, or -1 if there's no such */
+/* entry. */
+int64_t  DBFIndexGetRecord(DBFIndexHandle psIndex, int64_t iEntry) {
+  if (iEntry < 0 || iEntry >= psIndex->nEntries)
+    return -1;
+  return (int64_t) DBFIndexGet(psIndex->pabyEntries + iEntry * psIndex->nEntrySize
+                               + psIndex->nKeyWidth, 8);
+}
+
+/* DBFIndexClose */
+void  DBFIndexClose(DBFIndexHandle psIndex) {
+  if (psIndex != NULL) {
+    munmap(psIndex->pabyMap, psIndex->nMapSize);
+    free(psIndex);
+  }
+}
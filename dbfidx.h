@@ -0,0 +1,36 @@
+#ifndef DBFIDX_H_INCLUDED
+#define DBFIDX_H_INCLUDED
+/*
+** dbfidx.h
+**
+** Sorted key indexes of a field of a DBF file, kept in a sidecar file,
+** for finding the records with a given value without a scan. See
+** dbfidx.c.
+*/
+
+#include "dbf.h"
+
+typedef struct {
+  unsigned char *pabyMap;
+  size_t  nMapSize;
+  const unsigned char *pabyEntries;
+  int     nKeyWidth;
+  int     nEntrySize;
+  int64_t nEntries;
+  int64_t nDBFRecords;
+  int     nDBFRecordLength;
+  char    szFieldName[12];
+  char    chFieldType;
+  int     bNumeric;
+} DBFIndexInfo;
+
+typedef DBFIndexInfo* DBFIndexHandle;
+
+int DBFIndexCreate(DBFHandle, int iField, const char* pszFilename);
+DBFIndexHandle DBFIndexOpen(const char* pszFilename);
+int64_t DBFIndexFind(DBFIndexHandle, const char* pszKey, int64_t* piFirstEntry);
+int64_t DBFIndexGetRecord(DBFIndexHandle, int64_t iEntry);
+int DBFIndexMatches(DBFIndexHandle, DBFHandle);
+void DBFIndexClose(DBFIndexHandle);
+
+#endif /* DBFIDX_H_INCLUDED */
@@ -0,0 +1,150 @@
+/*
+** dbfindex.c
+**
+** Builds a sorted key index of a field of a DBF file, in a sidecar
+** file, or looks up keys in one. With -k, the records with each key
+** are written on stdout: the record number (counting from 0), then
+** the record's values, tab-separated.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "dbf.h"
+#include "dbfidx.h"
+
+#define FS "\t"
+#define RS "\n"
+#define USAGE "Usage: dbfindex [-k key]... dbf-file field [index-file]\n"
+
+/*
+** Forward declarations
+*/
+
+char* index_filename(const char* dbf_filename, const char* field_name);
+int   lookup(DBFHandle dbf_file, DBFIndexHandle index, const char* key);
+void  write_record(DBFHandle dbf_file, int64_t record);
+
+/*
+** Command line options
+*/
+
+static struct option long_options[] = {
+  {"key", required_argument, NULL, 'k'},
+  {NULL,  0,                 NULL, 0}
+};
+
+/*
+** Main
+*/
+
+int main(int argc, char **argv){
+  DBFHandle      dbf_file;
+  DBFIndexHandle index;
+  char           **keys = malloc(argc*sizeof(char*));
+  char           *filename, name[12];
+  int            i, field, opt, num_keys = 0, status = EXIT_SUCCESS;
+
+  // Options, then the DBF file, the field and perhaps the index file.
+  while ((opt = getopt_long(argc, argv, "k:", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'k':
+      keys[num_keys++] = optarg;
+      break;
+    default:
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  if (argc-optind < 2 || argc-optind > 3) {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+
+  dbf_file = DBFOpen(argv[optind], "rm");
+  if (dbf_file == NULL) {
+    fprintf(stderr, "%s can't be read or is not a DBF file\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  field = DBFFindField(dbf_file, argv[optind+1]);
+  if (field < 0) {
+    fprintf(stderr, "%s is not a field of the DBF file\n", argv[optind+1]);
+    DBFClose(dbf_file);
+    return EXIT_FAILURE;
+  }
+  DBFGetFieldInfo(dbf_file, field, name, NULL, NULL);
+  if (argc-optind == 3)
+    filename = strdup(argv[optind+2]);
+  else
+    filename = index_filename(argv[optind], name);
+
+  if (num_keys == 0) {
+    // Build the index.
+    if (!DBFIndexCreate(dbf_file, field, filename)) {
+      fprintf(stderr, "%s could not be written\n", filename);
+      status = EXIT_FAILURE;
+    }
+  } else {
+    // Look up the keys.
+    index = DBFIndexOpen(filename);
+    if (index == NULL) {
+      fprintf(stderr, "%s can't be read or is not an index file\n", filename);
+      status = EXIT_FAILURE;
+    } else if (strcmp(index->szFieldName, name) != 0 || !DBFIndexMatches(index, dbf_file)) {
+      fprintf(stderr, "%s is not an up-to-date index of field %s\n", filename, name);
+      status = EXIT_FAILURE;
+    } else {
+      for (i = 0; i < num_keys; i++)
+        lookup(dbf_file, index, keys[i]);
+    }
+    DBFIndexClose(index);
+  }
+
+  free(filename);
+  free(keys);
+  DBFClose(dbf_file);
+  return status;
+}
+
+// Writes out the records with a key, returning how many there are.
+int lookup(DBFHandle dbf_file, DBFIndexHandle index, const char* key) {
+  int64_t first, n, i;
+
+  n = DBFIndexFind(index, key, &first);
+  for (i = 0; i < n; i++)
+    write_record(dbf_file, DBFIndexGetRecord(index, first + i));
+  return n;
+}
+
+// Writes a record's number and its (trimmed) values, tab-separated.
+void write_record(DBFHandle dbf_file, int64_t record) {
+  const char *tuple = DBFReadTuple64(dbf_file, record), *value;
+  int        i, length;
+
+  if (tuple == NULL)
+    return;
+  printf("%lld", (long long) record);
+  for (i = 0; i < DBFGetFieldCount(dbf_file); i++) {
+    fputs(FS, stdout);
+    DBFGetTupleFieldView(dbf_file, tuple, i, &value, &length);
+    if (!DBFIsFieldViewNULL(dbf_file, i, value, length))
+      fwrite(value, 1, length, stdout);
+  }
+  fputs(RS, stdout);
+}
+
+// The default index file name: the DBF file name, less any .dbf, then
+// the field name and .idx, e.g. parcels.PARCELID.idx.
+char* index_filename(const char* dbf_filename, const char* field_name) {
+  size_t n = strlen(dbf_filename);
+  char   *filename = malloc(n + strlen(field_name) + 6);
+
+  if (n > 4 && (strcmp(dbf_filename + n - 4, ".dbf") == 0
+                || strcmp(dbf_filename + n - 4, ".DBF") == 0))
+    n -= 4;
+  sprintf(filename, "%.*s.%s.idx", (int) n, dbf_filename, field_name);
+  return filename;
+}
+
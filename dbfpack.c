@@ -0,0 +1,114 @@
+/*
+** dbfpack.c
+**
+** Packs a DBF file: copies it to a new DBF file without its deleted
+** records. The input is read a block at a time, in one pass, and the
+** records which are kept are written a block at a time, so that files
+** of any size are packed in a small, fixed amount of memory.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "dbf.h"
+
+#define USAGE "Usage: dbfpack in-dbf-file out-dbf-file\n"
+
+/*
+** Forward declarations
+*/
+
+int   same_file(const char* filename1, const char* filename2);
+int   pack(DBFHandle in_file, DBFHandle out_file);
+
+/*
+** Main
+*/
+
+int main(int argc, char **argv){
+  DBFHandle in_file, out_file;
+  int       status;
+
+  if (argc != 3) {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+  if (same_file(argv[1], argv[2])) {
+    fprintf(stderr, "%s would be packed onto itself\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  if (strcmp(argv[1], "-") == 0)
+    in_file = DBFOpenStream(stdin);
+  else
+    in_file = DBFOpen(argv[1], "rb");
+  if (in_file == NULL) {
+    fprintf(stderr, "%s can't be read or is not a DBF file\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  out_file = DBFCloneEmpty(in_file, argv[2]);
+  if (out_file == NULL) {
+    fprintf(stderr, "%s could not be created\n", argv[2]);
+    DBFClose(in_file);
+    return EXIT_FAILURE;
+  }
+
+  status = pack(in_file, out_file) ? EXIT_SUCCESS : EXIT_FAILURE;
+  DBFClose(out_file);
+  DBFClose(in_file);
+  return status;
+}
+
+// Copies the records of in_file which aren't deleted to out_file, a
+// block at a time. Returns 0 if the records could not all be read, or
+// a block could not be written.
+int pack(DBFHandle in_file, DBFHandle out_file) {
+  DBFScanHandle scan = DBFScanOpen64(in_file, 0, -1, 0);
+  int           record_length = DBFGetRecordLength(in_file);
+  int           i, num_records, num_kept, capacity = 0, ok = 1;
+  int64_t       first_record, num_scanned = 0;
+  const char    *block, *record;
+  char          *kept = NULL;
+
+  while (ok && scan != NULL
+         && (block = DBFScanNextBlock64(scan, &first_record, &num_records)) != NULL) {
+    if (num_records > capacity) {
+      capacity = num_records;
+      free(kept);
+      kept = malloc((size_t) capacity * record_length);
+    }
+    num_scanned += num_records;
+    num_kept = 0;
+    for (i = 0; i < num_records; i++) {
+      record = block + (size_t) i * record_length;
+      if (!DBFIsTupleDeleted(in_file, record))
+        memcpy(kept + (size_t) num_kept++ * record_length, record, record_length);
+    }
+    ok = DBFAppendRecordBlock(out_file, kept, num_kept);
+  }
+  if (ok && (DBFScanFailed(scan) || num_scanned != DBFGetRecordCount64(in_file))) {
+    fprintf(stderr, "Only %lld of the %lld records could be read\n",
+            (long long) num_scanned, (long long) DBFGetRecordCount64(in_file));
+    ok = 0;
+  }
+  DBFScanClose(scan);
+  free(kept);
+  return ok;
+}
+
+// Whether two file names name the same file. An output file which
+// doesn't exist yet is never the same as the input.
+int same_file(const char* filename1, const char* filename2) {
+  struct stat stat1, stat2;
+
+  if (strcmp(filename1, "-") == 0) {
+    if (fstat(fileno(stdin), &stat1) != 0)
+      return 0;
+  } else if (stat(filename1, &stat1) != 0) {
+    return 0;
+  }
+  if (stat(filename2, &stat2) != 0)
+    return 0;
+  return stat1.st_dev == stat2.st_dev && stat1.st_ino == stat2.st_ino;
+}
@@ -0,0 +1,355 @@
+/*
+** dbfstat.c
+**
+** Profiles the fields of a DBF file in a single scan of its records:
+** for each field, the number of values and of NULLs, the least and
+** greatest values, the width of the widest (trimmed) value and an
+** estimate of the number of distinct values. The profile is written
+** on stdout as TSV, one row per field, or (with -J) as JSON.
+**
+** The records are read a block at a time, and each block is profiled
+** a field at a time, straight from the bytes of the records. Distinct
+** values are counted approximately, with a HyperLogLog sketch per
+** field, so that memory use doesn't grow with the data.
+**
+** The profiling is done a value at a time rather than with vector
+** instructions: nearly all of its time goes on finding each value's
+** extent, testing it for NULL, parsing numbers and hashing, which vary
+** with each value, while the min and max are a compare or two.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include "dbf.h"
+
+#define FS "\t"
+#define RS "\n"
+#define HLL_BITS      14
+#define HLL_REGISTERS (1 << HLL_BITS)
+#define USAGE "Usage: dbfstat [-J] [-d] dbf-file\n"
+
+/*
+** The profile of a field so far. Numeric fields keep their least and
+** greatest values as numbers, other fields as trimmed text, compared
+** byte by byte.
+*/
+
+typedef struct field_stats_t {
+  int           field;
+  char          name[12];
+  char          type;
+  int           numeric;
+  int           width;
+  int           decimals;
+  int64_t       values;
+  int64_t       nulls;
+  int           max_width;
+  double        min;
+  double        max;
+  char          *min_text;
+  int           min_length;
+  char          *max_text;
+  int           max_length;
+  unsigned char *registers;
+} field_stats;
+
+/*
+** Forward declarations
+*/
+
+void     profile_block(DBFHandle dbf_file, field_stats* stats, const char* block,
+                       int num_records, int record_length, const char* keep);
+int      compare_text(const char* text1, int length1, const char* text2, int length2);
+void     hll_add(unsigned char* registers, uint64_t hash);
+double   hll_estimate(const unsigned char* registers);
+uint64_t hash_bytes(const void* bytes, int length);
+void     write_tsv(field_stats* stats, int num_fields);
+void     write_json(field_stats* stats, int num_fields, int64_t num_records);
+void     write_value(field_stats* stats, int is_max, int json);
+void     write_json_string(const char* text, int length);
+
+/*
+** Command line options
+*/
+
+static struct option long_options[] = {
+  {"json",    no_argument, NULL, 'J'},
+  {"deleted", no_argument, NULL, 'd'},
+  {NULL,      0,           NULL, 0}
+};
+
+/*
+** Main
+*/
+
+int main(int argc, char **argv){
+  DBFHandle     dbf_file;
+  DBFScanHandle scan;
+  field_stats   *stats;
+  const char    *block;
+  char          *keep = NULL;
+  int           i, opt, num_fields, record_length, num_records, capacity = 0;
+  int           json = 0, deleted = 0, status = EXIT_SUCCESS;
+  int64_t       first_record, num_profiled = 0;
+
+  while ((opt = getopt_long(argc, argv, "Jd", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'J':
+      json = 1;
+      break;
+    case 'd':
+      deleted = 1;
+      break;
+    default:
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  if (argc-optind != 1) {
+    fprintf(stderr, USAGE);
+    return EXIT_FAILURE;
+  }
+
+  if (strcmp(argv[optind], "-") == 0)
+    dbf_file = DBFOpenStream(stdin);
+  else
+    dbf_file = DBFOpen(argv[optind], "rm");
+  if (dbf_file == NULL) {
+    fprintf(stderr, "%s can't be read or is not a DBF file\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  // Set up the profile of each field.
+  num_fields = DBFGetFieldCount(dbf_file);
+  record_length = DBFGetRecordLength(dbf_file);
+  stats = calloc(num_fields, sizeof(field_stats));
+  for (i = 0; i < num_fields; i++) {
+    DBFFieldType type = DBFGetFieldInfo(dbf_file, i, stats[i].name,
+                                        &stats[i].width, &stats[i].decimals);
+    stats[i].field = i;
+    stats[i].type = DBFGetNativeFieldType(dbf_file, i);
+    stats[i].numeric = type == FTInteger || type == FTDouble;
+    stats[i].min_text = malloc(stats[i].width + 1);
+    stats[i].max_text = malloc(stats[i].width + 1);
+    stats[i].registers = calloc(HLL_REGISTERS, 1);
+  }
+
+  // Profile the records a block at a time, leaving out deleted ones
+  // unless -d was given.
+  scan = DBFScanOpen64(dbf_file, 0, -1, 0);
+  while (scan != NULL
+         && (block = DBFScanNextBlock64(scan, &first_record, &num_records)) != NULL) {
+    if (num_records > capacity) {
+      capacity = num_records;
+      free(keep);
+      keep = malloc(capacity);
+    }
+    for (i = 0; i < num_records; i++) {
+      keep[i] = deleted || !DBFIsTupleDeleted(dbf_file, block + (size_t) i * record_length);
+      num_profiled += keep[i];
+    }
+    for (i = 0; i < num_fields; i++)
+      profile_block(dbf_file, &stats[i], block, num_records, record_length, keep);
+  }
+
+  // A profile of only some of the records would pass for one of them
+  // all, so there is none unless they could all be read.
+  if (DBFScanFailed(scan)) {
+    fprintf(stderr, "%s could not all be read\n", argv[optind]);
+    status = EXIT_FAILURE;
+  } else if (json) {
+    write_json(stats, num_fields, num_profiled);
+  } else {
+    write_tsv(stats, num_fields);
+  }
+  DBFScanClose(scan);
+
+  for (i = 0; i < num_fields; i++) {
+    free(stats[i].min_text);
+    free(stats[i].max_text);
+    free(stats[i].registers);
+  }
+  free(stats);
+  free(keep);
+  DBFClose(dbf_file);
+  return status;
+}
+
+// Adds one field of a block of records to its profile.
+void profile_block(DBFHandle dbf_file, field_stats* stats, const char* block,
+                   int num_records, int record_length, const char* keep) {
+  const char *record = block, *value;
+  int        i, length;
+  double     number;
+
+  for (i = 0; i < num_records; i++, record += record_length) {
+    if (!keep[i])
+      continue;
+    DBFGetTupleFieldView(dbf_file, record, stats->field, &value, &length);
+    if (DBFIsFieldViewNULL(dbf_file, stats->field, value, length)) {
+      stats->nulls++;
+      continue;
+    }
+    if (length > stats->max_width)
+      stats->max_width = length;
+
+    if (stats->numeric) {
+      // Numbers are told apart by value, not by how they're written.
+      number = DBFReadTupleDoubleAttribute(dbf_file, record, stats->field);
+      if (number == 0.0)
+        number = 0.0;
+      if (stats->values == 0 || number < stats->min)
+        stats->min = number;
+      if (stats->values == 0 || number > stats->max)
+        stats->max = number;
+      hll_add(stats->registers, hash_bytes(&number, sizeof(number)));
+    } else {
+      if (stats->values == 0
+          || compare_text(value, length, stats->min_text, stats->min_length) < 0) {
+        memcpy(stats->min_text, value, length);
+        stats->min_length = length;
+      }
+      if (stats->values == 0
+          || compare_text(value, length, stats->max_text, stats->max_length) > 0) {
+        memcpy(stats->max_text, value, length);
+        stats->max_length = length;
+      }
+      hll_add(stats->registers, hash_bytes(value, length));
+    }
+    stats->values++;
+  }
+}
+
+// Compares two texts byte by byte, a prefix coming first.
+int compare_text(const char* text1, int length1, const char* text2, int length2) {
+  int cmp = memcmp(text1, text2, length1 < length2 ? length1 : length2);
+
+  return cmp != 0 ? cmp : length1 - length2;
+}
+
+// Adds a hashed value to a HyperLogLog sketch: the first HLL_BITS
+// bits of the hash pick a register, which keeps the greatest position
+// of the first 1 bit seen in the rest.
+void hll_add(unsigned char* registers, uint64_t hash) {
+  uint64_t      rest = hash << HLL_BITS;
+  unsigned char rank = 1;
+
+  while (rank <= 64 - HLL_BITS && !(rest >> 63)) {
+    rest <<= 1;
+    rank++;
+  }
+  if (rank > registers[hash >> (64 - HLL_BITS)])
+    registers[hash >> (64 - HLL_BITS)] = rank;
+}
+
+// Estimates the number of distinct values added to a HyperLogLog
+// sketch, counting the empty registers instead when there are few.
+double hll_estimate(const unsigned char* registers) {
+  double m = HLL_REGISTERS, sum = 0, estimate;
+  int    i, empty = 0;
+
+  for (i = 0; i < HLL_REGISTERS; i++) {
+    sum += ldexp(1.0, -registers[i]);
+    empty += registers[i] == 0;
+  }
+  estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (estimate <= 2.5 * m && empty > 0)
+    estimate = m * log(m / empty);
+  return estimate;
+}
+
+// Hashes bytes to 64 bits: FNV-1a, then the MurmurHash3 finalizer,
+// which spreads FNV's weak high bits over the whole hash.
+uint64_t hash_bytes(const void* bytes, int length) {
+  const unsigned char *p = bytes;
+  uint64_t            hash = 0xcbf29ce484222325ULL;
+  int                 i;
+
+  for (i = 0; i < length; i++)
+    hash = (hash ^ p[i]) * 0x100000001b3ULL;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// Writes the profile as TSV: a header row, then a row per field.
+void write_tsv(field_stats* stats, int num_fields) {
+  int i;
+
+  fputs("field" FS "type" FS "width" FS "decimals" FS "values" FS "nulls" FS
+        "min" FS "max" FS "max_width" FS "distinct" RS, stdout);
+  for (i = 0; i < num_fields; i++) {
+    printf("%s" FS "%c" FS "%d" FS "%d" FS "%lld" FS "%lld" FS,
+           stats[i].name, stats[i].type, stats[i].width, stats[i].decimals,
+           (long long) stats[i].values, (long long) stats[i].nulls);
+    write_value(&stats[i], 0, 0);
+    fputs(FS, stdout);
+    write_value(&stats[i], 1, 0);
+    printf(FS "%d" FS "%.0f" RS, stats[i].max_width, hll_estimate(stats[i].registers));
+  }
+}
+
+// Writes the profile as a JSON object, with the number of records
+// profiled and an array with an object per field.
+void write_json(field_stats* stats, int num_fields, int64_t num_records) {
+  int i;
+
+  printf("{\"records\":%lld,\"fields\":[", (long long) num_records);
+  for (i = 0; i < num_fields; i++) {
+    printf("%s{\"field\":", i > 0 ? "," : "");
+    write_json_string(stats[i].name, strlen(stats[i].name));
+    printf(",\"type\":\"%c\",\"width\":%d,\"decimals\":%d,\"values\":%lld,\"nulls\":%lld,\"min\":",
+           stats[i].type, stats[i].width, stats[i].decimals,
+           (long long) stats[i].values, (long long) stats[i].nulls);
+    write_value(&stats[i], 0, 1);
+    fputs(",\"max\":", stdout);
+    write_value(&stats[i], 1, 1);
+    printf(",\"max_width\":%d,\"distinct\":%.0f}",
+           stats[i].max_width, hll_estimate(stats[i].registers));
+  }
+  fputs("]}" RS, stdout);
+}
+
+// Writes a field's least or greatest value, numbers in the format of
+// the field. A field with no values has none: nothing in TSV, null in
+// JSON. JSON has no infinities or NaNs either, so they are null too.
+void write_value(field_stats* stats, int is_max, int json) {
+  double number = is_max ? stats->max : stats->min;
+
+  if (stats->values == 0 || (json && stats->numeric && !isfinite(number))) {
+    if (json)
+      fputs("null", stdout);
+  } else if (stats->numeric) {
+    printf("%.*f", stats->decimals, number);
+  } else if (json) {
+    write_json_string(is_max ? stats->max_text : stats->min_text,
+                      is_max ? stats->max_length : stats->min_length);
+  } else {
+    fwrite(is_max ? stats->max_text : stats->min_text, 1,
+           is_max ? stats->max_length : stats->min_length, stdout);
+  }
+}
+
+// Writes text as a JSON string, escaping quotes, backslashes and
+// control characters. Other bytes are written as they are.
+void write_json_string(const char* text, int length) {
+  int i;
+
+  putchar('"');
+  for (i = 0; i < length; i++) {
+    unsigned char c = text[i];
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
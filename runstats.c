@@ -0,0 +1,111 @@
+/*
+** runstats.c
+**
+** Timings and counts of a run of one of the programs, reported with
+** --stats. A run is divided into named phases, each timed in wall
+** clock and CPU seconds (the CPU time of all the threads), and the
+** program adds up the rows, values and bytes it converts. A phase can
+** be left and taken up again, as when a loop alternates between
+** reading and formatting, and its times are added up. At the end
+** these are reported, with the I/O counts of the DBF file and rates
+** over the whole run. When not enabled, nothing is timed, so the
+** only cost is a test at the start of each phase.
+*/
+
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "runstats.h"
+
+static double wall_seconds(void);
+static double cpu_seconds(void);
+
+// Sets up the statistics of a run, with no phases yet.
+void runstats_init(runstats* rs, int enabled) {
+  memset(rs, 0, sizeof(runstats));
+  rs->enabled = enabled;
+}
+
+// Ends the current phase, if any, and starts the named one, or takes
+// it up again if it has been started before. Returns the name of the
+// phase which was ended, for taking it up again in turn, or NULL if
+// there was none (or the statistics aren't enabled, or rs is NULL). A
+// NULL name just ends the current phase.
+const char* runstats_start(runstats* rs, const char* name) {
+  const char *previous;
+  int        i;
+
+  if (rs == NULL || !rs->enabled)
+    return NULL;
+  previous = rs->current != NULL ? rs->current->name : NULL;
+  runstats_stop(rs);
+  if (name == NULL)
+    return previous;
+  for (i = 0; i < rs->num_phases && strcmp(rs->phases[i].name, name) != 0; i++)
+    ;
+  if (i == RUNSTATS_MAX_PHASES)
+    return previous;
+  if (i == rs->num_phases)
+    rs->phases[rs->num_phases++].name = name;
+  rs->current = &rs->phases[i];
+  rs->wall_start = wall_seconds();
+  rs->cpu_start = cpu_seconds();
+  return previous;
+}
+
+// Ends the current phase, adding its times to it.
+void runstats_stop(runstats* rs) {
+  if (!rs->enabled || rs->current == NULL)
+    return;
+  rs->current->wall += wall_seconds() - rs->wall_start;
+  rs->current->cpu += cpu_seconds() - rs->cpu_start;
+  rs->current = NULL;
+}
+
+// Writes the report: the times of each phase and in all, the counts,
+// the DBF file's I/O counts (if io isn't NULL) and the rates.
+void runstats_report(runstats* rs, const char* program, DBFIOStats* io, FILE* fp) {
+  double wall = 0, cpu = 0;
+  int    i;
+
+  if (!rs->enabled)
+    return;
+  runstats_stop(rs);
+  fprintf(fp, "%s stats:\n", program);
+  fprintf(fp, "  %-10s %10s %10s\n", "phase", "wall s", "cpu s");
+  for (i = 0; i < rs->num_phases; i++) {
+    fprintf(fp, "  %-10s %10.3f %10.3f\n", rs->phases[i].name,
+            rs->phases[i].wall, rs->phases[i].cpu);
+    wall += rs->phases[i].wall;
+    cpu += rs->phases[i].cpu;
+  }
+  fprintf(fp, "  %-10s %10.3f %10.3f\n", "total", wall, cpu);
+  fprintf(fp, "  rows %lld, values %lld, bytes in %lld, bytes out %lld\n",
+          (long long) rs->rows, (long long) rs->values,
+          (long long) rs->bytes_in, (long long) rs->bytes_out);
+  if (io != NULL)
+    fprintf(fp, "  DBF reads %lld, writes %lld, seeks %lld, bytes read %lld, bytes written %lld\n",
+            (long long) io->nReads, (long long) io->nWrites, (long long) io->nSeeks,
+            (long long) io->nBytesRead, (long long) io->nBytesWritten);
+  if (wall > 0)
+    fprintf(fp, "  %.0f rows/s, %.0f values/s, %.1f MB/s in, %.1f MB/s out\n",
+            rs->rows / wall, rs->values / wall,
+            rs->bytes_in / 1e6 / wall, rs->bytes_out / 1e6 / wall);
+}
+
+// The time in seconds, from a monotonic clock.
+static double wall_seconds(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The user and system CPU time of the process, in seconds.
+static double cpu_seconds(void) {
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+    + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
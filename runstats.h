@@ -0,0 +1,45 @@
+#ifndef RUNSTATS_H_INCLUDED
+#define RUNSTATS_H_INCLUDED
+/*
+** runstats.h
+**
+** Timings and counts of a run of one of the programs, for --stats.
+** See runstats.c.
+*/
+
+#include <stdio.h>
+#include "dbf.h"
+
+#define RUNSTATS_MAX_PHASES 8
+
+typedef struct runstats_phase_t {
+  const char *name;
+  double     wall;
+  double     cpu;
+} runstats_phase;
+
+/*
+** The phases timed so far, the current one and its start, with
+** the rows and values converted and the bytes of input and output,
+** which the program counts as it goes.
+*/
+
+typedef struct runstats_t {
+  int            enabled;
+  int            num_phases;
+  runstats_phase phases[RUNSTATS_MAX_PHASES];
+  runstats_phase *current;
+  double         wall_start;
+  double         cpu_start;
+  int64_t        rows;
+  int64_t        values;
+  int64_t        bytes_in;
+  int64_t        bytes_out;
+} runstats;
+
+void runstats_init(runstats* rs, int enabled);
+const char* runstats_start(runstats* rs, const char* name);
+void runstats_stop(runstats* rs);
+void runstats_report(runstats* rs, const char* program, DBFIOStats* io, FILE* fp);
+
+#endif /* RUNSTATS_H_INCLUDED */
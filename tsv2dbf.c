@@ -7,6 +7,13 @@
 ** determining the appropriate field types for the columns, by inspecting
 ** the column values in the rows.
 **
+** The input is read only once, so that it can be a pipe. Each row's
+** values are kept in a row store while the types are worked out, and
+** written to the DBF file from there once they are known. With -j,
+** the input is split into chunks of whole lines, whose types are
+** worked out on worker threads, and the stored rows into blocks, which
+** are encoded as DBF records and written on worker threads.
+**
 ** DBF functions based on shapelib (shapelib.maptools.org).
 */
 
@@ -14,116 +21,325 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <getopt.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "dbf.h"
+#include "runstats.h"
 
-#define MAX_COLUMN_WIDTH 4096
-#define MAX_LINE_LENGTH  4096
-#define MAX_COLUMNS      30
+#define MEMORY_BUDGET    256
+#define READ_SIZE        (1024*1024)
+#define BLOCK_SIZE       (4*1024*1024)
 #define RS '\n'
 #define FS '\t'
 #define max(a,b) (((a)>=(b))?(a):(b))
+#define USAGE "Usage: tsv2dbf [-j threads] [-m megabytes] [--stats] tsv-file dbf-file\n"
 
 int debug = 0;
 
 /*
-** Struct for holding columns (headers and field values)
+** Struct for holding columns (headers and field values). The value is
+** a slice of the line in the reader's buffer, not a copy, so it is only
+** good until the next line is read, and is not NUL-terminated.
 */
 
 typedef struct column_t {
   DBFFieldType type;
   int          width;
   int          decimals;
-  char         value[MAX_COLUMN_WIDTH];
+  const char   *value;
 } column;
 
+/*
+** Reader of the lines of the TSV file. The file is read a large block
+** at a time, and lines are found in the block with memchr(), which is
+** vectorized, rather than a character at a time. A line is only moved
+** if it runs past the end of the block.
+*/
+
+typedef struct reader_t {
+  FILE    *fp;
+  char    *data;
+  size_t  size;
+  size_t  start;
+  size_t  end;
+  int     eof;
+  int64_t bytes;
+} reader;
+
+/*
+** Store of the data rows, between reading them and writing them to
+** the DBF file. Each row is the end offsets of its values (uint32_t),
+** then the values one after another, padded to a multiple of 4 bytes.
+** Rows are added to memory until the budget is used up, then spilled
+** to a temporary file, so any number of rows can be held. They are
+** read back in order: the spilled ones, then those still in memory.
+*/
+
+typedef struct rowstore_t {
+  int      num_columns;
+  char     *data;
+  size_t   length;
+  size_t   size;
+  size_t   budget;
+  FILE     *spill;
+  size_t   position;
+  int      spill_done;
+  char     *row;
+  size_t   row_size;
+} rowstore;
+
+/*
+** A chunk of whole lines of the input, and what is worked out from
+** them: the number of lines, those with the wrong number of fields
+** (counting from 0 in the chunk), and the type, width and decimals
+** which fit all the values of each field.
+*/
+
+typedef struct chunk_t {
+  const char *data;
+  size_t     length;
+  int        num_columns;
+  int        num_lines;
+  int        *bad_lines;
+  int        num_bad;
+  int        bad_size;
+  column     *fields;
+  column     *columns;
+  int        capacity;
+} chunk;
+
+/*
+** A block of stored rows, to be encoded as the DBF records from
+** first_record on: the rows, laid out as in the row store, and the
+** records, with the number of values encoded and those which didn't
+** fit their fields, as row and column pairs.
+*/
+
+typedef struct block_t {
+  int      chunk;
+  int      done;
+  int64_t  first_record;
+  int      num_rows;
+  char     *rows;
+  size_t   rows_length;
+  size_t   rows_size;
+  char     *records;
+  char     *value;
+  int64_t  values;
+  int      *errors;
+  int      num_errors;
+  int      errors_size;
+  int      ok;
+} block;
+
+/*
+** State shared by the threads of a parallel (-j) pass. In the pass
+** over the input, the main thread reads the chunks, and copies chunk k
+** into slot k % num_slots, for a worker to store its rows and work out
+** their types. The main thread takes the slots back in chunk order,
+** adding their rows to the row store and their types to the fields,
+** so the result is the same as from a single thread. In the pass which
+** writes the records, the main thread reads the stored rows into the
+** blocks the same way, and the workers encode and write them; as each
+** block has its own place in the file, only the reports of values that
+** didn't fit need to wait to be taken back in order.
+*/
+
+typedef struct slot_t {
+  int      chunk;
+  int      done;
+  int      ok;
+  char     *data;
+  size_t   size;
+  chunk    ck;
+  rowstore rows;
+} slot;
+
+typedef struct job_t {
+  int             next_chunk;
+  int             num_chunks;
+  int             eof;
+  int             num_slots;
+  slot            *slots;
+  block           *blocks;
+  DBFHandle       dbf_file;
+  column          *fields;
+  int             num_columns;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+} job;
+
 /*
 ** Forward declarations
 */
 
-int   get_columns(FILE* tsv_file, column** columns, int row);
+void  reader_init(reader* in, FILE* fp);
+int   read_line(reader* in, const char** line, size_t* length);
+int   read_chunk(reader* in, const char** data, size_t* length);
+void  reader_fill(reader* in);
+int   get_columns(const char* line, size_t length, column** columns, int* capacity);
+DBFFieldType classify_value(const char* value, int width, int* decimals);
+void  merge_type(column* field, const column* col);
+void  chunk_init(chunk* ck, int num_columns);
+void  chunk_reset(chunk* ck);
+int   infer_chunk(chunk* ck, rowstore* store);
+int   report_chunk(chunk* ck, column* fields, int row);
+void  chunk_free(chunk* ck);
+int   infer_parallel(reader* in, rowstore* store, column* fields, int num_threads);
+void* infer_worker(void* arg);
+int   drain_slot(job* jb, slot* s, rowstore* store, column* fields, int* row);
+void  block_init(block* b, int num_rows, int record_length, int value_size);
+int   block_fill(block* b, rowstore* store, int max_rows);
+int   encode_block(block* b, DBFHandle dbf_file, column* fields, int num_columns);
+int   report_block(block* b, int64_t* values);
+void  block_free(block* b);
+int   encode_parallel(rowstore* store, DBFHandle dbf_file, column* fields, int value_size,
+                      int num_threads, int64_t* rows, int64_t* values);
+void* encode_worker(void* arg);
+int   drain_block(job* jb, block* b, int64_t* values);
+void  store_init(rowstore* store, int num_columns, size_t budget);
+char* store_reserve(rowstore* store, size_t length);
+int   store_add(rowstore* store, column* columns);
+int   store_append(rowstore* store, const char* data, size_t length);
+void  store_rewind(rowstore* store);
+int   store_next(rowstore* store, const uint32_t** ends, const char** values);
+void  store_free(rowstore* store);
 void  dump_column(char* tag, int i, int j, column* col);
 char* type_to_str(DBFFieldType t);
 
+/*
+** Command line options
+*/
+
+static struct option long_options[] = {
+  {"jobs",   required_argument, NULL, 'j'},
+  {"memory", required_argument, NULL, 'm'},
+  {"stats",  no_argument,       NULL, 'S'},
+  {NULL,     0,                 NULL, 0}
+};
+
 /*
 ** Main
 */
 
 int main( int argc, char ** argv ) {
   FILE*     tsv_file = NULL;
+  reader    in;
   DBFHandle dbf_file = NULL;
-  int       num_columns, i, j, rows=0, values=0;
-  column    *columns = NULL;
+  int       num_columns = 0, i, j, ok = 1, record_length, rows_per_block;
+  int64_t   rows=0, values=0;
   column    *fields = NULL;
-  char      c;
+  char      **titles = NULL;
+  int       fields_capacity = 0, value_size = 0;
+  int       opt, stats = 0, memory = MEMORY_BUDGET, num_threads = 1;
+  rowstore  store;
+  chunk     ck;
+  block     blk;
+  const char *line;
+  size_t    length;
+  runstats  rs;
+  DBFIOStats io;
 
-  // Check that there are two arguments, the input TSV file and
+  // Options, then two arguments, the input TSV file (- for stdin) and
   // the output DBF file.
-  if (argc!=3) {
-    fprintf(stderr, "Usage: tsv2dbf tsv-file dbf-file\n");
+  while ((opt = getopt_long(argc, argv, "j:m:", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'j':
+      num_threads = atoi(optarg);
+      if (num_threads >= 1)
+        break;
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    case 'm':
+      memory = atoi(optarg);
+      if (memory >= 1)
+        break;
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    case 'S':
+      stats = 1;
+      break;
+    default:
+      fprintf(stderr, USAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  if (argc-optind!=2) {
+    fprintf(stderr, USAGE);
     return EXIT_FAILURE;
   }
+  runstats_init(&rs, stats);
+  runstats_start(&rs, "open");
+  memset(&store, 0, sizeof(rowstore));
   
   // Open DBF file
-  dbf_file = DBFCreate(argv[2]);
+  dbf_file = DBFCreate(argv[optind+1]);
   if (dbf_file == NULL) {
-    fprintf(stderr, "%s file cannot be created\n", argv[2]);
+    fprintf(stderr, "%s file cannot be created\n", argv[optind+1]);
     return EXIT_FAILURE;
   }
 
   // Open TSV file.
-  tsv_file = fopen(argv[1],"r");
+  if (strcmp(argv[optind], "-") == 0)
+    tsv_file = stdin;
+  else
+    tsv_file = fopen(argv[optind],"r");
   if (tsv_file == NULL) {
-    fprintf(stderr, "%s cannot be opened\n", argv[1]);
+    fprintf(stderr, "%s cannot be opened\n", argv[optind]);
     DBFClose(dbf_file);
     return EXIT_FAILURE;
   }
 
   // Read  header row of TSV file for titles.
-  num_columns = get_columns(tsv_file, &fields, 1);
+  reader_init(&in, tsv_file);
+  num_columns = -1;
+  if (read_line(&in, &line, &length))
+    num_columns = get_columns(line, length, &fields, &fields_capacity);
   if (num_columns <= 0) {
-    fprintf(stderr, "%s can't be read or is not a DBF file\n", argv[1]);
-    return EXIT_FAILURE;
+    fprintf(stderr, "%s can't be read or is not a DBF file\n", argv[optind]);
+    num_columns = 0;
+    ok = 0;
+    goto finish;
   }
 
-  // Initialize type, widths in header array
+  // Keep the titles, which are only slices of the header line, and
+  // initialize type, widths in header array
+  titles = malloc(num_columns*sizeof(char*));
   for (j=0; j<num_columns; j++) {
+    titles[j] = strndup(fields[j].value, fields[j].width);
     fields[j].type=FTInteger;
     fields[j].width=0;
     fields[j].decimals=0;
   }
 
-  // Loop through TSV data rows, determining the 
-  // most restrictive data type for each column which will
-  // permit all the actual TSV values to be loaded.
-  for (i=1; !feof(tsv_file); i++) {
-    int num_field_columns = get_columns(tsv_file, &columns, i+1);
+  runstats_start(&rs, "infer");
 
-    if (num_field_columns==0)
-      continue;
-    if (num_field_columns != num_columns) {
-      fprintf(stderr, "Wrong number of fields at row %d. Row ignored.", i+1);
-      continue;
-    } 
-    for (j=0; j<num_columns; j++) {
-      fields[j].width=max(columns[j].width, fields[j].width);
-      switch(columns[j].type) {
-      case FTString:
-        fields[j].type=FTString;
-        break;
-      case FTDouble:
-        if (fields[j].type==FTInteger) {
-          fields[j].type=FTDouble;
-          fields[j].decimals=columns[j].decimals;
-        } else if (fields[j].type==FTDouble) {
-          fields[j].decimals=max(columns[j].decimals, fields[j].decimals);
-        } 
-        break;
-      default:
-        break;
-      }
+  // Loop through the chunks of TSV data rows, storing the rows and
+  // determining the most restrictive data type for each column which
+  // will permit all the actual TSV values to be loaded.
+  store_init(&store, num_columns, (size_t) memory * 1024 * 1024);
+  if (num_threads > 1) {
+    ok = infer_parallel(&in, &store, fields, num_threads);
+  } else {
+    chunk_init(&ck, num_columns);
+    for (i=2; ok && read_chunk(&in, &ck.data, &ck.length); ) {
+      chunk_reset(&ck);
+      ok = infer_chunk(&ck, &store);
+      if (ok)
+        i = report_chunk(&ck, fields, i);
     }
+    chunk_free(&ck);
+  }
+  if (!ok) {
+    fprintf(stderr, "The rows could not be stored in a temporary file\n");
+    goto finish;
   }
 
+  rs.bytes_in = in.bytes;
+
   // Make columns that had all empty values into strings.
   for (j=0; j<num_columns; j++) {
     if (fields[j].width==0) {
@@ -132,129 +348,788 @@ int main( int argc, char ** argv ) {
     }
   }
   
-  // Define the fields of the  DBF file.
+  // Define the fields of the  DBF file. The values are copied to a
+  // buffer to NUL-terminate them, so it must fit the widest. The header
+  // is written now, for the records to be written after it.
   for (i=0; i<num_columns; i++) {
-    int ret=DBFAddField(dbf_file, fields[i].value, fields[i].type, 
+    int ret=DBFAddField(dbf_file, titles[i], fields[i].type, 
                 fields[i].width, fields[i].decimals);
-    if (ret==-1) 
+    if (ret==-1) {
       fprintf(stderr,"Error adding field %d to DBF file\n",i);
+      ok = 0;
+      goto finish;
+    }
+    value_size = max(value_size, fields[i].width+1);
   }
+  DBFUpdateHeader(dbf_file);
 
-  // Reset TSV file and skip over header row.
-  fseek(tsv_file, 0, SEEK_SET);
-  while((c = getc(tsv_file)) != RS) { /* empty loop */}
+  runstats_start(&rs, "write");
 
-  // Read the data rows and write the column values into the DBF file.
-  for (i=0; !feof(tsv_file); i++) {
-    int num_field_columns = get_columns(tsv_file, &columns, i+1);
+  // Read the stored data rows back a block at a time, encode the
+  // column values as DBF records, record i for the ith row, and write
+  // each block of records at its place in the file.
+  store_rewind(&store);
+  if (num_threads > 1) {
+    ok = encode_parallel(&store, dbf_file, fields, value_size, num_threads, &rows, &values);
+  } else {
+    record_length = DBFGetRecordLength(dbf_file);
+    rows_per_block = max(BLOCK_SIZE / record_length, 1);
+    block_init(&blk, rows_per_block, record_length, value_size);
+    while (ok && block_fill(&blk, &store, rows_per_block) > 0) {
+      blk.first_record = rows;
+      encode_block(&blk, dbf_file, fields, num_columns);
+      ok = report_block(&blk, &values);
+      rows += blk.num_rows;
+    }
+    block_free(&blk);
+  }
+  if (!ok)
+    goto finish;
 
-    if (num_field_columns != num_columns)
-      continue;
+  // Some information on stderr
+  for (i=0; i<DBFGetFieldCount(dbf_file); i++) {
+    int width, decimals; 
+    char title[12];
+    DBFFieldType type = DBFGetFieldInfo(dbf_file, i, title, &width, &decimals);
+    fprintf(stderr, "%d %s %s %d.%d\n", i, title, type_to_str(type), width, decimals);
+  }
+  fprintf(stderr, "Data rows: %lld, Non-null values: %lld\n",
+          (long long) rows, (long long) values);
 
-    rows++;
-    for (j=0; j<num_columns; j++) {
-      int ret=0;
+  // Finish, on success or after any failure once the DBF file was
+  // created. The record count in the header is set by DBFClose.
+ finish:
+  runstats_start(&rs, "close");
+  DBFGetIOStats(dbf_file, &io);
+  store_free(&store);
+  free(in.data);
+  if (titles != NULL)
+    for (j=0; j<num_columns; j++)
+      free(titles[j]);
+  free(titles);
+  free(fields);
+  if (tsv_file != stdin)
+    fclose(tsv_file);
+  DBFClose(dbf_file);
+  if (!ok)
+    return EXIT_FAILURE;
+  rs.rows = rows;
+  rs.values = values;
+  rs.bytes_out = io.nBytesWritten;
+  runstats_report(&rs, "tsv2dbf", &io, stderr);
+  return EXIT_SUCCESS;
+}
 
-      if (columns[j].value[0]==0)
-        continue;
+// Sets up a reader of the lines of a file.
+void reader_init(reader* in, FILE* fp) {
+  memset(in, 0, sizeof(reader));
+  in->fp = fp;
+  in->size = READ_SIZE;
+  in->data = malloc(in->size);
+}
+
+// Finds the next line, setting *line to its start and *length to its
+// length, without the line-feed. A last line with no line-feed is a
+// line too. Returns 0 at the end of the file.
+int read_line(reader* in, const char** line, size_t* length) {
+  char   *feed;
+  size_t searched = 0;
+
+  for (;;) {
+    feed = memchr(in->data + in->start + searched, RS, in->end - in->start - searched);
+    if (feed != NULL) {
+      *line = in->data + in->start;
+      *length = feed - *line;
+      in->start += *length + 1;
+      return 1;
+    }
+    searched = in->end - in->start;
+    if (in->eof) {
+      if (searched == 0)
+        return 0;
+      *line = in->data + in->start;
+      *length = searched;
+      in->start = in->end;
+      return 1;
+    }
+    reader_fill(in);
+  }
+}
+
+// Finds the next chunk of whole lines: all those left in the buffer,
+// or if there are none, those in the next block read. Sets *data to
+// its start and *length to its length, with the last line-feed.
+// Returns 0 at the end of the file.
+int read_chunk(reader* in, const char** data, size_t* length) {
+  char *feed;
+
+  for (;;) {
+    if (in->start < in->end) {
+      for (feed = in->data + in->end; feed > in->data + in->start && feed[-1] != RS; feed--)
+        ;
+      feed = feed > in->data + in->start ? feed - 1 : NULL;
+      if (feed != NULL || in->eof) {
+        *data = in->data + in->start;
+        *length = feed != NULL ? (size_t) (feed + 1 - *data) : in->end - in->start;
+        in->start += *length;
+        return 1;
+      }
+    } else if (in->eof) {
+      return 0;
+    }
+    reader_fill(in);
+  }
+}
+
+// Moves the partial line left in the buffer to the front, growing the
+// buffer if the line fills it, and reads another block after it.
+void reader_fill(reader* in) {
+  size_t n, left = in->end - in->start;
+
+  memmove(in->data, in->data + in->start, left);
+  in->start = 0;
+  in->end = left;
+  if (in->size - in->end < READ_SIZE / 2) {
+    in->size *= 2;
+    in->data = realloc(in->data, in->size);
+  }
+  n = fread(in->data + in->end, 1, in->size - in->end, in->fp);
+  in->end += n;
+  in->bytes += n;
+  if (n == 0)
+    in->eof = 1;
+}
+
+// Finds the next tab at or after p, or else end. With SSE2, sixteen
+// bytes are compared at a time.
+static inline const char* find_tab(const char* p, const char* end) {
+#ifdef __SSE2__
+  const __m128i tabs = _mm_set1_epi8(FS);
 
+  while (end - p >= 16) {
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), tabs));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (p < end && *p != FS)
+    p++;
+  return p;
+}
+
+// Splits a line of a TSV file and puts fields into "columns" array,
+// growing it (and *capacity, its length) to fit as many as there are.
+// Returns the number of fields.
+int get_columns(const char* line, size_t length, column** columns, int* capacity) {
+  const char *p, *end, *tab;
+  int        n=0;
+  column     *col;
+
+  // Split line of TSV file into columns and set type, decimals, and width.
+  p = line;
+  end = line + length;
+  for (;;) {
+    if (n>=*capacity) {
+      *capacity = max(2 * *capacity, 32);
+      *columns = realloc(*columns, *capacity*sizeof(column));
+    }
+    tab = find_tab(p, end);
+    col = &(*columns)[n++];
+    col->value = p;
+    col->width = tab - p;
+    col->type = classify_value(p, col->width, &col->decimals);
+    if (tab==end)
+      break;
+    p = tab+1;
+  }
+  return  n;
+}
+
+// Works out the type of a value from the whole of it: digits are an
+// integer (as is an empty value), digits with one decimal point a
+// double with the digits after the point as its decimals, and anything
+// else a string.
+DBFFieldType classify_value(const char* value, int width, int* decimals) {
+  int i = 0, point;
+
+  *decimals = 0;
+  while (i<width && (unsigned char) (value[i]-'0') <= 9)
+    i++;
+  if (i==width)
+    return FTInteger;
+  if (value[i]!='.')
+    return FTString;
+  point = ++i;
+  while (i<width && (unsigned char) (value[i]-'0') <= 9)
+    i++;
+  if (i<width)
+    return FTString;
+  *decimals = width-point;
+  return FTDouble;
+}
+
+// Merges the type of a value into that of its field: the field
+// becomes the most restrictive type which fits both, as wide as the
+// wider. Two fields are merged the same way, as long as they are
+// merged in the order of their rows.
+void merge_type(column* field, const column* col) {
+  field->width=max(col->width, field->width);
+  switch(col->type) {
+  case FTString:
+    if (field->type==FTInteger)
+      field->decimals=col->decimals;
+    else if (field->type==FTDouble)
+      field->decimals=max(col->decimals, field->decimals);
+    field->type=FTString;
+    break;
+  case FTDouble:
+    if (field->type==FTInteger) {
+      field->type=FTDouble;
+      field->decimals=col->decimals;
+    } else if (field->type==FTDouble) {
+      field->decimals=max(col->decimals, field->decimals);
+    } 
+    break;
+  default:
+    break;
+  }
+}
+
+// Sets up a chunk for rows of num_columns values.
+void chunk_init(chunk* ck, int num_columns) {
+  memset(ck, 0, sizeof(chunk));
+  ck->num_columns = num_columns;
+  ck->fields = malloc(num_columns*sizeof(column));
+  chunk_reset(ck);
+}
+
+// Makes the chunk's fields all empty integers, which any type merged
+// into them replaces.
+void chunk_reset(chunk* ck) {
+  int j;
+
+  for (j=0; j<ck->num_columns; j++) {
+    ck->fields[j].type=FTInteger;
+    ck->fields[j].width=0;
+    ck->fields[j].decimals=0;
+  }
+}
+
+// Splits the lines of a chunk into fields, and adds the rows with the
+// right number of them to the row store and their types to the
+// chunk's fields. Returns 0 if the rows could not be stored.
+int infer_chunk(chunk* ck, rowstore* store) {
+  const char *line = ck->data, *end = ck->data + ck->length, *feed;
+  int        i, j, n;
+
+  ck->num_lines = 0;
+  ck->num_bad = 0;
+  for (i=0; line < end; i++) {
+    feed = memchr(line, RS, end - line);
+    if (feed == NULL)
+      feed = end;
+    n = get_columns(line, feed - line, &ck->columns, &ck->capacity);
+    line = feed + 1;
+    if (n != ck->num_columns) {
+      if (ck->num_bad == ck->bad_size) {
+        ck->bad_size = max(2 * ck->bad_size, 16);
+        ck->bad_lines = realloc(ck->bad_lines, ck->bad_size * sizeof(int));
+      }
+      ck->bad_lines[ck->num_bad++] = i;
+      continue;
+    }
+    if (!store_add(store, ck->columns))
+      return 0;
+    for (j=0; j<n; j++) {
       if (debug==2)
-        dump_column("row", i, j, &columns[j]);
+        dump_column("row", i, j, &ck->columns[j]);
+      merge_type(&ck->fields[j], &ck->columns[j]);
+    }
+  }
+  ck->num_lines = i;
+  return 1;
+}
+
+// Reports the rows of a chunk with the wrong number of fields, the
+// first line of the chunk being the given row of the file, and merges
+// the chunk's types into fields. Returns the row of the line after the
+// chunk.
+int report_chunk(chunk* ck, column* fields, int row) {
+  int i;
+
+  for (i=0; i<ck->num_bad; i++)
+    fprintf(stderr, "Wrong number of fields at row %d. Row ignored.\n", row + ck->bad_lines[i]);
+  for (i=0; i<ck->num_columns; i++)
+    merge_type(&fields[i], &ck->fields[i]);
+  return row + ck->num_lines;
+}
+
+// Frees a chunk's arrays.
+void chunk_free(chunk* ck) {
+  free(ck->bad_lines);
+  free(ck->fields);
+  free(ck->columns);
+}
+
+// Reads the chunks of the input, and has num_threads worker threads
+// store their rows and work out their types, which are added to the
+// row store and fields in chunk order by this thread. Returns 0 if
+// the rows could not be stored.
+int infer_parallel(reader* in, rowstore* store, column* fields, int num_threads) {
+  job        jb;
+  pthread_t  *threads;
+  const char *data;
+  size_t     length;
+  int        i, k, ok = 1, row = 2;
+
+  jb.next_chunk = 0;
+  jb.num_chunks = 0;
+  jb.eof = 0;
+  jb.num_slots = 2 * num_threads;
+  jb.slots = malloc(jb.num_slots * sizeof(slot));
+  for (i = 0; i < jb.num_slots; i++) {
+    jb.slots[i].chunk = -1;
+    jb.slots[i].done = 0;
+    jb.slots[i].ok = 1;
+    jb.slots[i].data = NULL;
+    jb.slots[i].size = 0;
+    chunk_init(&jb.slots[i].ck, store->num_columns);
+    store_init(&jb.slots[i].rows, store->num_columns, (size_t) -1);
+  }
+  pthread_mutex_init(&jb.lock, NULL);
+  pthread_cond_init(&jb.cond, NULL);
+
+  threads = malloc(num_threads * sizeof(pthread_t));
+  for (i = 0; i < num_threads; i++)
+    pthread_create(&threads[i], NULL, infer_worker, &jb);
+
+  // Each slot is taken back from its last chunk before it is given
+  // the next.
+  for (k = 0; read_chunk(in, &data, &length); k++) {
+    slot *s = &jb.slots[k % jb.num_slots];
+
+    if (k >= jb.num_slots && !drain_slot(&jb, s, store, fields, &row))
+      ok = 0;
+    if (s->size < length) {
+      s->size = length;
+      s->data = realloc(s->data, s->size);
+    }
+    memcpy(s->data, data, length);
+    s->ck.data = s->data;
+    s->ck.length = length;
+    s->done = 0;
+
+    pthread_mutex_lock(&jb.lock);
+    s->chunk = k;
+    jb.num_chunks = k+1;
+    pthread_cond_broadcast(&jb.cond);
+    pthread_mutex_unlock(&jb.lock);
+  }
+  pthread_mutex_lock(&jb.lock);
+  jb.eof = 1;
+  pthread_cond_broadcast(&jb.cond);
+  pthread_mutex_unlock(&jb.lock);
+
+  for (i = max(k - jb.num_slots, 0); i < k; i++)
+    if (!drain_slot(&jb, &jb.slots[i % jb.num_slots], store, fields, &row))
+      ok = 0;
+
+  for (i = 0; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+  for (i = 0; i < jb.num_slots; i++) {
+    free(jb.slots[i].data);
+    chunk_free(&jb.slots[i].ck);
+    store_free(&jb.slots[i].rows);
+  }
+  free(jb.slots);
+  free(threads);
+  pthread_mutex_destroy(&jb.lock);
+  pthread_cond_destroy(&jb.cond);
+  return ok;
+}
+
+// Worker thread for infer_parallel. Takes the next chunk, waits for it
+// to be copied into its slot, and works through it into the slot's own
+// rows and fields, noting in the slot if the rows could not be stored.
+void* infer_worker(void* arg) {
+  job *jb = arg;
+
+  pthread_mutex_lock(&jb->lock);
+  for (;;) {
+    int  k = jb->next_chunk++;
+    slot *s = &jb->slots[k % jb->num_slots];
+
+    while (s->chunk != k && !(jb->eof && k >= jb->num_chunks))
+      pthread_cond_wait(&jb->cond, &jb->lock);
+    if (s->chunk != k)
+      break;
+    pthread_mutex_unlock(&jb->lock);
 
-      values++;
+    s->rows.length = 0;
+    chunk_reset(&s->ck);
+    s->ok = infer_chunk(&s->ck, &s->rows);
+
+    pthread_mutex_lock(&jb->lock);
+    s->done = 1;
+    pthread_cond_broadcast(&jb->cond);
+  }
+  pthread_mutex_unlock(&jb->lock);
+  return NULL;
+}
+
+// Waits for the worker on a slot to finish, then adds its rows to the
+// row store and its types to fields, and reports its bad rows, the
+// first line of the chunk being row *row, which is moved on past the
+// chunk. Returns 0 if the rows could not be stored.
+int drain_slot(job* jb, slot* s, rowstore* store, column* fields, int* row) {
+  pthread_mutex_lock(&jb->lock);
+  while (!s->done)
+    pthread_cond_wait(&jb->cond, &jb->lock);
+  pthread_mutex_unlock(&jb->lock);
+
+  *row = report_chunk(&s->ck, fields, *row);
+  if (!s->ok)
+    return 0;
+  return store_append(store, s->rows.data, s->rows.length);
+}
+
+// Sets up an empty row store for rows of num_columns values, holding
+// up to budget bytes of them in memory.
+void store_init(rowstore* store, int num_columns, size_t budget) {
+  memset(store, 0, sizeof(rowstore));
+  store->num_columns = num_columns;
+  store->budget = budget;
+  store->size = 65536;
+  store->data = malloc(store->size);
+}
+
+// Sets up a block for up to num_rows rows, with values of up to
+// value_size bytes with their NULs.
+void block_init(block* b, int num_rows, int record_length, int value_size) {
+  memset(b, 0, sizeof(block));
+  b->chunk = -1;
+  b->records = malloc((size_t) num_rows * record_length);
+  b->value = malloc(value_size);
+}
+
+// Reads up to max_rows rows from the store into the block. Returns how
+// many were read, 0 after the last row.
+int block_fill(block* b, rowstore* store, int max_rows) {
+  size_t         header = store->num_columns * sizeof(uint32_t), row_length;
+  const uint32_t *ends;
+  const char     *values;
+
+  b->num_rows = 0;
+  b->rows_length = 0;
+  while (b->num_rows < max_rows && store_next(store, &ends, &values)) {
+    row_length = header + (ends[store->num_columns-1] + 3) / 4 * 4;
+    if (b->rows_length + row_length > b->rows_size) {
+      b->rows_size = max(2 * b->rows_size, b->rows_length + row_length);
+      b->rows = realloc(b->rows, b->rows_size);
+    }
+    memcpy(b->rows + b->rows_length, ends, row_length);
+    b->rows_length += row_length;
+    b->num_rows++;
+  }
+  return b->num_rows;
+}
+
+// Encodes the rows of a block as DBF records, built with the
+// DBFSetTuple functions, and writes them to their place in the file.
+// Returns 0 if they could not be written.
+int encode_block(block* b, DBFHandle dbf_file, column* fields, int num_columns) {
+  size_t         header = num_columns * sizeof(uint32_t), position = 0;
+  int            record_length = DBFGetRecordLength(dbf_file);
+  int            i, j, ret, start;
+  const uint32_t *ends;
+  char           *record;
+
+  b->values = 0;
+  b->num_errors = 0;
+  for (i=0; i<b->num_rows; i++) {
+    ends = (const uint32_t*) (b->rows + position);
+    record = b->records + (size_t) i * record_length;
+    DBFBlankTuple(dbf_file, record);
+    for (j=0; j<num_columns; j++) {
+      start = j>0 ? ends[j-1] : 0;
+      if (ends[j]==start)
+        continue;
+      memcpy(b->value, b->rows + position + header + start, ends[j]-start);
+      b->value[ends[j]-start] = 0;
+      b->values++;
       switch (fields[j].type) {
       case FTInteger:
-        ret=DBFWriteIntegerAttribute(dbf_file, i, j, atoi(columns[j].value));
+        ret=DBFSetTupleIntegerAttribute(dbf_file, record, j, atoi(b->value));
         break;
       case FTDouble:
-        ret=DBFWriteDoubleAttribute(dbf_file, i, j, atof(columns[j].value));
-        break;
-      case FTString:
-        ret=DBFWriteStringAttribute(dbf_file, i, j, columns[j].value);
+        ret=DBFSetTupleDoubleAttribute(dbf_file, record, j, atof(b->value));
         break;
-      // These won't occur, but are mentioned to avoid a compiler warning.
-      case FTLogical:
-      case FTInvalid:
+      default:
+        ret=DBFSetTupleStringAttribute(dbf_file, record, j, b->value);
         break;
       }
-      if (ret==0) 
-        fprintf(stderr,"Error writing column %d of row %d\n",j,rows);
+      if (ret==0) {
+        if (b->num_errors + 2 > b->errors_size) {
+          b->errors_size = max(2 * b->errors_size, 16);
+          b->errors = realloc(b->errors, b->errors_size * sizeof(int));
+        }
+        b->errors[b->num_errors++] = i;
+        b->errors[b->num_errors++] = j;
+      }
     }
+    position += header + (ends[num_columns-1] + 3) / 4 * 4;
   }
+  b->ok = DBFWriteRecordBlock64(dbf_file, b->first_record, b->records, b->num_rows);
+  return b->ok;
+}
 
+// Reports the values of a block which didn't fit their fields, and adds
+// the number of values encoded to *values. Returns 0 if the block
+// could not be written.
+int report_block(block* b, int64_t* values) {
+  int i;
 
-  // Some information on stderr
-  for (i=0; i<DBFGetFieldCount(dbf_file); i++) {
-    int width, decimals; 
-    char title[12];
-    DBFFieldType type = DBFGetFieldInfo(dbf_file, i, title, &width, &decimals);
-    fprintf(stderr, "%d %s %s %d.%d\n", i, title, type_to_str(type), width, decimals);
+  for (i=0; i<b->num_errors; i+=2)
+    fprintf(stderr,"Error writing column %d of row %lld\n", b->errors[i+1],
+            (long long) (b->first_record + b->errors[i] + 1));
+  *values += b->values;
+  return b->ok;
+}
+
+// Frees a block's buffers.
+void block_free(block* b) {
+  free(b->rows);
+  free(b->records);
+  free(b->value);
+  free(b->errors);
+}
+
+// Reads the stored rows into blocks, and has num_threads worker
+// threads encode and write them, adding the rows and values written to
+// *rows and *values. Returns 0 if they could not all be written.
+int encode_parallel(rowstore* store, DBFHandle dbf_file, column* fields, int value_size,
+                    int num_threads, int64_t* rows, int64_t* values) {
+  job       jb;
+  pthread_t *threads;
+  int       i, k, drained = 0, ok = 1;
+  int       record_length = DBFGetRecordLength(dbf_file);
+  int       rows_per_block = max(BLOCK_SIZE / record_length, 1);
+
+  jb.next_chunk = 0;
+  jb.num_chunks = 0;
+  jb.eof = 0;
+  jb.num_slots = 2 * num_threads;
+  jb.dbf_file = dbf_file;
+  jb.fields = fields;
+  jb.num_columns = store->num_columns;
+  jb.blocks = malloc(jb.num_slots * sizeof(block));
+  for (i = 0; i < jb.num_slots; i++)
+    block_init(&jb.blocks[i], rows_per_block, record_length, value_size);
+  pthread_mutex_init(&jb.lock, NULL);
+  pthread_cond_init(&jb.cond, NULL);
+
+  threads = malloc(num_threads * sizeof(pthread_t));
+  for (i = 0; i < num_threads; i++)
+    pthread_create(&threads[i], NULL, encode_worker, &jb);
+
+  // Each block is taken back from its last rows before it is given
+  // the next.
+  for (k = 0; ; k++) {
+    block *b = &jb.blocks[k % jb.num_slots];
+
+    if (k >= jb.num_slots) {
+      if (!drain_block(&jb, b, values))
+        ok = 0;
+      drained = k - jb.num_slots + 1;
+    }
+    if (block_fill(b, store, rows_per_block) == 0)
+      break;
+    b->first_record = *rows;
+    *rows += b->num_rows;
+    b->done = 0;
+
+    pthread_mutex_lock(&jb.lock);
+    b->chunk = k;
+    jb.num_chunks = k+1;
+    pthread_cond_broadcast(&jb.cond);
+    pthread_mutex_unlock(&jb.lock);
   }
-  fprintf(stderr, "Data rows: %d, Non-null values: %d\n", rows, values);
+  pthread_mutex_lock(&jb.lock);
+  jb.eof = 1;
+  pthread_cond_broadcast(&jb.cond);
+  pthread_mutex_unlock(&jb.lock);
 
-  // Finish
-  free(columns);
-  free(fields);
-  DBFClose(dbf_file);
-  return EXIT_SUCCESS;
+  for (i = drained; i < k; i++)
+    if (!drain_block(&jb, &jb.blocks[i % jb.num_slots], values))
+      ok = 0;
+
+  for (i = 0; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+  for (i = 0; i < jb.num_slots; i++)
+    block_free(&jb.blocks[i]);
+  free(jb.blocks);
+  free(threads);
+  pthread_mutex_destroy(&jb.lock);
+  pthread_cond_destroy(&jb.cond);
+  return ok;
 }
 
-// Reads a data row from a TSV file and puts fields into
-// "columns" array.
-int get_columns(FILE* tsv_file, column** columns, int row) {
-  int n=0, width=0, decimals=0;
-  char c = 0;
-  DBFFieldType type = FTInteger;
+// Worker thread for encode_parallel. Takes the next block, waits for
+// its rows to be read, and encodes and writes them.
+void* encode_worker(void* arg) {
+  job *jb = arg;
 
-  // Initialize columns array.
-  if (*columns==NULL)
-    *columns = malloc(MAX_COLUMNS*sizeof(column));
-  memset(*columns, 0, MAX_COLUMNS*sizeof(column));
+  pthread_mutex_lock(&jb->lock);
+  for (;;) {
+    int   k = jb->next_chunk++;
+    block *b = &jb->blocks[k % jb->num_slots];
 
-  // Split line of TSV file into columns and set type, decimals, and width.
-  while ((c=getc(tsv_file)) 
-         && !feof(tsv_file) 
-         && width<MAX_COLUMN_WIDTH 
-         && n<MAX_COLUMNS) {
-    if (c==RS || c==FS) {
-      (*columns)[n].type = type;
-      (*columns)[n].width = width;
-      if (type==FTDouble) 
-        (*columns)[n].decimals = decimals;
-      n++;
-      type = FTInteger;
-      width = 0;
-      decimals = 0;
-      if (c==RS)
-        break;
-    } else {
-      (*columns)[n].value[width++] = c;
-      if (isdigit(c)) {
-        if (type==FTDouble)
-          decimals++;
-      } else {
-        switch(type) {
-        case FTInteger:
-          type = (c=='.'? FTDouble: FTString);
-          break;
-        default:
-          type = FTString;
-        }
+    while (b->chunk != k && !(jb->eof && k >= jb->num_chunks))
+      pthread_cond_wait(&jb->cond, &jb->lock);
+    if (b->chunk != k)
+      break;
+    pthread_mutex_unlock(&jb->lock);
+
+    encode_block(b, jb->dbf_file, jb->fields, jb->num_columns);
+
+    pthread_mutex_lock(&jb->lock);
+    b->done = 1;
+    pthread_cond_broadcast(&jb->cond);
+  }
+  pthread_mutex_unlock(&jb->lock);
+  return NULL;
+}
+
+// Waits for the worker on a block to finish, then reports it as
+// report_block does.
+int drain_block(job* jb, block* b, int64_t* values) {
+  pthread_mutex_lock(&jb->lock);
+  while (!b->done)
+    pthread_cond_wait(&jb->cond, &jb->lock);
+  pthread_mutex_unlock(&jb->lock);
+
+  return report_block(b, values);
+}
+
+// Makes room for length more bytes at the end of the rows in memory,
+// first spilling them to the temporary file if they would go over
+// budget. Returns where the bytes go, or NULL if the rows could not be
+// spilled.
+char* store_reserve(rowstore* store, size_t length) {
+  if (store->length > 0 && store->length + length > store->budget) {
+    if (store->spill == NULL)
+      store->spill = tmpfile();
+    if (store->spill == NULL
+        || fwrite(store->data, 1, store->length, store->spill) != store->length)
+      return NULL;
+    store->length = 0;
+  }
+  if (store->length + length > store->size) {
+    while (store->length + length > store->size)
+      store->size *= 2;
+    store->data = realloc(store->data, store->size);
+  }
+  store->length += length;
+  return store->data + store->length - length;
+}
+
+// Adds a row to the store. Returns 0 if the rows could not be spilled
+// to make room for it.
+int store_add(rowstore* store, column* columns) {
+  size_t   header = store->num_columns * sizeof(uint32_t), row_length;
+  uint32_t end = 0;
+  char     *row;
+  int      j;
+
+  for (j=0; j<store->num_columns; j++)
+    end += columns[j].width;
+  row_length = header + (end + 3) / 4 * 4;
+
+  row = store_reserve(store, row_length);
+  if (row == NULL)
+    return 0;
+  end = 0;
+  for (j=0; j<store->num_columns; j++) {
+    memcpy(row + header + end, columns[j].value, columns[j].width);
+    end += columns[j].width;
+    memcpy(row + j * sizeof(uint32_t), &end, sizeof(uint32_t));
+  }
+  memset(row + header + end, 0, row_length - header - end);
+  return 1;
+}
+
+// Adds rows laid out as in the store, from another store, to the
+// store. Returns 0 if the rows could not be spilled to make room.
+int store_append(rowstore* store, const char* data, size_t length) {
+  char *rows = store_reserve(store, length);
+
+  if (rows == NULL)
+    return 0;
+  memcpy(rows, data, length);
+  return 1;
+}
+
+// Goes back to the first row of the store, to read the rows back.
+void store_rewind(rowstore* store) {
+  store->position = 0;
+  store->spill_done = store->spill == NULL;
+  if (store->spill != NULL) {
+    fflush(store->spill);
+    rewind(store->spill);
+  }
+}
+
+// Reads back the next row of the store, setting *ends to the end
+// offsets of its values, and *values to the values. Returns 0 after
+// the last row.
+int store_next(rowstore* store, const uint32_t** ends, const char** values) {
+  size_t   header = store->num_columns * sizeof(uint32_t), row_length;
+  uint32_t end;
+
+  if (!store->spill_done) {
+    if (store->row_size < header) {
+      store->row_size = header + 4096;
+      store->row = realloc(store->row, store->row_size);
+    }
+    if (fread(store->row, 1, header, store->spill) == header) {
+      memcpy(&end, store->row + header - sizeof(uint32_t), sizeof(uint32_t));
+      row_length = header + (end + 3) / 4 * 4;
+      if (store->row_size < row_length) {
+        store->row_size = row_length;
+        store->row = realloc(store->row, store->row_size);
+      }
+      if (fread(store->row + header, 1, row_length - header, store->spill)
+          == row_length - header) {
+        *ends = (const uint32_t*) store->row;
+        *values = store->row + header;
+        return 1;
       }
     }
+    store->spill_done = 1;
   }
-  
-  if (width>=MAX_COLUMN_WIDTH)
-    fprintf(stderr,"Column exceeds maximum width at row %d\n", row);
-  if (n>=MAX_COLUMNS)
-    fprintf(stderr,"Too many columns at row %d\n", row);
-  return  n;
+
+  if (store->position >= store->length)
+    return 0;
+  memcpy(&end, store->data + store->position + header - sizeof(uint32_t), sizeof(uint32_t));
+  *ends = (const uint32_t*) (store->data + store->position);
+  *values = store->data + store->position + header;
+  store->position += header + (end + 3) / 4 * 4;
+  return 1;
+}
+
+// Frees the store, and deletes its temporary file.
+void store_free(rowstore* store) {
+  if (store->spill != NULL)
+    fclose(store->spill);
+  free(store->data);
+  free(store->row);
 }
 
 // For debugging, dumps column information on stderr.
 void dump_column(char* tag, int i, int j, column* col) {
-  fprintf(stderr,"%s [%d,%d] %s %d %d %s\n", tag, i, j, 
-          type_to_str(col->type), col->width, col->decimals, col->value);
+  fprintf(stderr,"%s [%d,%d] %s %d %d %.*s\n", tag, i, j, 
+          type_to_str(col->type), col->width, col->decimals, col->width, col->value);
 }
 
 // Converts field type to string.